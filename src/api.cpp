@@ -15,6 +15,7 @@ void Api::setup(
     addCommand(Command("rs", reverseStrainProcessor));
     addCommand(Command("dp", doublePowerProcessor));
     addCommand(Command("sd", sleepDelayProcessor));
+    addCommand(Command("id", idleDelayProcessor));
     addCommand(Command("hc", hallCharProcessor));
     addCommand(Command("ho", hallOffsetProcessor));
     addCommand(Command("ht", hallThresholdProcessor));
@@ -23,12 +24,23 @@ void Api::setup(
     addCommand(Command("stl", strainThresLowProcessor));
     addCommand(Command("mdm", motionDetectionMethodProcessor));
     addCommand(Command("sleep", sleepProcessor));
+    addCommand(Command("boot", bootProcessor));
+    addCommand(Command("task", taskProcessor));
     addCommand(Command("ntm", negativeTorqueMethodProcessor));
     addCommand(Command("at", autoTareProcessor));
     addCommand(Command("atd", autoTareDelayMsProcessor));
     addCommand(Command("atr", autoTareRangeGProcessor));
+    addCommand(Command("pm", pedalMetricsProcessor));
+    addCommand(Command("cpm", cpmFieldsProcessor));
+    addCommand(Command("ss", strainStreamProcessor));
+    addCommand(Command("gate", notifyGateProcessor));
+    addCommand(Command("conn", connectionProcessor));
+    addCommand(Command("sps", strainRateProcessor));
 #ifdef FEATURE_MPU
     addCommand(Command("ml", mpuLogIntervalProcessor));
+    addCommand(Command("mf", mpuFifoProcessor));
+    addCommand(Command("ma", mpuAdaptiveRateProcessor));
+    addCommand(Command("fu", fusionProcessor));
 #endif
 }
 
@@ -48,6 +60,45 @@ void Api::beforeBleServiceStart(BLEService *service) {
         BLE_PROP::READ);
     char str[] = "Hall Effect Sensor reading";
     hallDesc->setValue((uint8_t *)str, strlen(str));
+
+    // add api char for reading torque effectiveness and pedal smoothness
+    bleServer->pmChar = service->createCharacteristic(
+        BLEUUID(PEDAL_METRICS_CHAR_UUID),
+        BLE_PROP::READ | BLE_PROP::NOTIFY);
+    bleServer->pmChar->setCallbacks(&board.bleServer);
+    bytes[0] = 0;
+    bytes[1] = 0;
+    bleServer->pmChar->setValue((uint8_t *)bytes, 2);  // set initial value
+    BLEDescriptor *pmDesc = bleServer->pmChar->createDescriptor(
+        BLEUUID(CHAR_USER_DESC_UUID),
+        BLE_PROP::READ);
+    char pmStr[] = "Torque effectiveness and pedal smoothness";
+    pmDesc->setValue((uint8_t *)pmStr, strlen(pmStr));
+
+    // add api char for streaming strain samples
+    bleServer->ssChar = service->createCharacteristic(
+        BLEUUID(STRAIN_STREAM_CHAR_UUID),
+        BLE_PROP::NOTIFY);
+    bleServer->ssChar->setCallbacks(&board.bleServer);
+    BLEDescriptor *ssDesc = bleServer->ssChar->createDescriptor(
+        BLEUUID(CHAR_USER_DESC_UUID),
+        BLE_PROP::READ);
+    char ssStr[] = "Strain stream, can be enabled in API";
+    ssDesc->setValue((uint8_t *)ssStr, strlen(ssStr));
+
+    // add api char for the binary framed api, see binary_api.h
+    // writes need the same security as the text api
+    uint32_t baProps = BLE_PROP::WRITE | BLE_PROP::WRITE_NR | BLE_PROP::NOTIFY;
+    if (secureBle) baProps |= BLE_PROP::WRITE_ENC | BLE_PROP::WRITE_AUTHEN;
+    bleServer->baChar = service->createCharacteristic(
+        BLEUUID(BINARY_API_CHAR_UUID),
+        baProps);
+    bleServer->baChar->setCallbacks(&board.bleServer);
+    BLEDescriptor *baDesc = bleServer->baChar->createDescriptor(
+        BLEUUID(CHAR_USER_DESC_UUID),
+        BLE_PROP::READ);
+    char baStr[] = "Binary API";
+    baDesc->setValue((uint8_t *)baStr, strlen(baStr));
 }
 
 Api::Result *Api::systemProcessor(Message *msg) {
@@ -92,18 +143,69 @@ Api::Result *Api::weightServiceProcessor(Message *msg) {
     return success();
 }
 
+// calibrate strain:
+// cs=knownMass[;ch:channel] -> knownMass                           linear, single point
+// cs=point:knownMass[;ch:channel] -> curve;...                     add curve point at the current reading
+// cs=fit:off|pwl|quad[;ch:channel] -> curve;...                    set curve mode
+// cs=clear[;ch:channel] -> curve;...                               remove all curve points
+// cs=curve[;ch:channel] -> curve;mode:str;points:raw/g,raw/g,...
 Api::Result *Api::calibrateStrainProcessor(Message *msg) {
     Api::Result *result = argInvalid();
+    uint8_t channel = STRAIN_RIGHT;
+    char buf[16];
+    if (msg->argGetParam("ch:", buf, sizeof(buf))) {
+        int i = atoi(buf);
+        if (i < 0 || board.strain.numChannels() <= i) return argInvalid();
+        channel = (uint8_t)i;
+    }
+    if (msg->argStartsWith("point:") ||
+        msg->argStartsWith("fit:") ||
+        msg->argStartsWith("clear") ||
+        msg->argStartsWith("curve")) {
+        bool changed = false;
+        if (msg->argGetParam("point:", buf, sizeof(buf))) {
+            float knownMass = (float)atof(buf);
+            if (knownMass <= 1 || 1000 <= knownMass) return argInvalid();
+            if (0 != board.strain.addCalibrationPoint(knownMass, channel)) return internalError();
+            changed = true;
+        } else if (msg->argGetParam("fit:", buf, sizeof(buf))) {
+            uint8_t mode = STRAIN_CURVE_MAX;
+            if (0 == strcmp("off", buf))
+                mode = STRAIN_CURVE_OFF;
+            else if (0 == strcmp("pwl", buf))
+                mode = STRAIN_CURVE_PWL;
+            else if (0 == strcmp("quad", buf))
+                mode = STRAIN_CURVE_QUAD;
+            if (!board.strain.setCurveMode(mode, channel)) return argInvalid();
+            changed = true;
+        } else if (msg->argStartsWith("clear")) {
+            board.strain.clearCurve(channel);
+            changed = true;
+        }
+        if (changed) board.strain.saveSettings();
+        StrainCurve *curve = &board.strain.channels[channel].curve;
+        const char *modes[] = {"off", "pwl", "quad"};
+        char reply[32];
+        snprintf(reply, sizeof(reply), "curve;mode:%s;points:", modes[curve->getMode()]);
+        msg->replyAppend(reply);
+        for (uint8_t i = 0; i < curve->size(); i++) {
+            snprintf(reply, sizeof(reply), "%s%d/%d",
+                     0 < i ? "," : "",
+                     curve->point(i)->raw,
+                     curve->point(i)->grams);
+            msg->replyAppend(reply);
+        }
+        return success();
+    }
     float knownMass;
     knownMass = (float)atof(msg->arg);
     if (1 < knownMass && knownMass < 1000) {
-        if (0 == board.strain.calibrateTo(knownMass)) {
+        if (0 == board.strain.calibrateTo(knownMass, channel)) {
             board.strain.saveSettings();
             result = success();
         } else
             result = internalError();
     }
-    char buf[16];
     snprintf(buf, sizeof(buf), "%f", knownMass);
     msg->replyAppend(buf);
     return result;
@@ -183,6 +285,24 @@ Api::Result *Api::sleepDelayProcessor(Message *msg) {
     return result;
 }
 
+// idle delay in ms, 0: disabled
+Api::Result *Api::idleDelayProcessor(Message *msg) {
+    Api::Result *result = success();
+    if (0 < strlen(msg->arg)) {
+        result = argInvalid();
+        int idleDelay = atoi(msg->arg);
+        if (0 == idleDelay || IDLE_WAKE_PERIOD_MS < idleDelay) {
+            board.idleDelay = (ulong)idleDelay;
+            board.saveSettings();
+            result = success();
+        }
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld;%d", board.idleDelay, (int)board.idle);
+    msg->replyAppend(buf);
+    return result;
+}
+
 Api::Result *Api::hallCharProcessor(Message *msg) {
     bool newValue = false;  // disable by default
     if (0 < strlen(msg->arg)) {
@@ -280,6 +400,65 @@ Api::Result *Api::sleepProcessor(Message *msg) {
     return result;
 }
 
+// boot stage timings: name:start+duration@core;... in ms
+Api::Result *Api::bootProcessor(Message *msg) {
+    board.bootProfile.print(msg->reply, msgReplyLength);
+    return success();
+}
+
+// Appends "name:running:freq:priority:free stack" of the registry entry.
+static void taskReplyAppend(Api::Message *msg, Board::TaskEntry *e) {
+    char buf[64];
+    int priority = e->priority;
+    int freeStack = -1;
+    if (e->running && nullptr != e->task && nullptr != e->task->taskHandle) {
+        priority = (int)uxTaskPriorityGet(e->task->taskHandle);
+        freeStack = (int)uxTaskGetStackHighWaterMark(e->task->taskHandle);
+    }
+    snprintf(buf, sizeof(buf), "%s:%d:%.1f:%d:%d",
+             e->name, (int)e->running, e->running ? e->runningFreq : 0.0f, priority, freeStack);
+    msg->replyAppend(buf);
+}
+
+// task[=name[:start|:stop|:restart|:freq:float|:prio:int]]
+// without an argument all tasks are listed, separated by ";"
+Api::Result *Api::taskProcessor(Message *msg) {
+    if (0 == strlen(msg->arg)) {
+        for (uint8_t i = 0; nullptr != board.taskAt(i); i++) {
+            if (0 < i) msg->replyAppend(";");
+            taskReplyAppend(msg, board.taskAt(i));
+        }
+        return success();
+    }
+    char name[16];
+    const char *op = strchr(msg->arg, ':');
+    size_t len = nullptr == op ? strlen(msg->arg) : (size_t)(op - msg->arg);
+    if (sizeof(name) <= len) return argInvalid();
+    strncpy(name, msg->arg, len);
+    name[len] = '\0';
+    Board::TaskEntry *e = board.task(name);
+    if (nullptr == e) return argInvalid();
+    bool ok = true;
+    if (nullptr != op) {
+        op++;
+        if (0 == strcmp("start", op))
+            ok = board.startTask(name);
+        else if (0 == strcmp("stop", op))
+            ok = board.stopTask(name);
+        else if (0 == strcmp("restart", op)) {
+            if (nullptr == e->task) return argInvalid();
+            board.restartTask(name);
+        } else if (0 == strncmp("freq:", op, 5))
+            ok = board.setTaskFreq(name, (float)atof(op + 5));
+        else if (0 == strncmp("prio:", op, 5))
+            ok = board.setTaskPriority(name, (int8_t)atoi(op + 5));
+        else
+            return argInvalid();
+    }
+    taskReplyAppend(msg, e);
+    return ok ? success() : error();
+}
+
 Api::Result *Api::negativeTorqueMethodProcessor(Message *msg) {
     Api::Result *result = error();
     if (0 < strlen(msg->arg)) {
@@ -354,4 +533,178 @@ Api::Result *Api::mpuLogIntervalProcessor(Message *msg) {
     msg->replyAppend(buf);
     return success();
 }
+
+Api::Result *Api::mpuFifoProcessor(Message *msg) {
+    if (0 < strlen(msg->arg)) {
+        bool newValue = 0 == strcmp("true", msg->arg) || 0 == strcmp("1", msg->arg);
+        board.motion.setMpuFifo(newValue);
+    }
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%d", (int)board.motion.mpuFifo);
+    msg->replyAppend(buf);
+    return success();
+}
+
+Api::Result *Api::mpuAdaptiveRateProcessor(Message *msg) {
+    if (0 < strlen(msg->arg)) {
+        bool newValue = 0 == strcmp("true", msg->arg) || 0 == strcmp("1", msg->arg);
+        board.motion.setMpuAdaptiveRate(newValue);
+    }
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%d", (int)board.motion.mpuAdaptiveRate);
+    msg->replyAppend(buf);
+    return success();
+}
+
+// fused crank detection counters, reset with "fu=reset"
+// reply: accepted;filled;rejected still;rejected early
+Api::Result *Api::fusionProcessor(Message *msg) {
+    if (msg->argIs("reset"))
+        board.strain.fusion.resetCounters();
+    else if (0 < strlen(msg->arg))
+        return argInvalid();
+    CrankFusion::Counters *c = &board.strain.fusion.counters;
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%lu;%lu;%lu;%lu",
+             (ulong)c->accepted, (ulong)c->filled, (ulong)c->rejectedStill, (ulong)c->rejectedEarly);
+    msg->replyAppend(buf);
+    return success();
+}
 #endif
+
+// get/set pedal metrics char updates: pm[=0|1] -> 0|1;te:float;ps:float
+// torque effectiveness and pedal smoothness are computed from the right channel only
+Api::Result *Api::pedalMetricsProcessor(Message *msg) {
+    bool newValue = false;  // disable by default
+    if (0 < strlen(msg->arg)) {
+        if (0 == strcmp("true", msg->arg) || 0 == strcmp("1", msg->arg)) {
+            newValue = true;
+        }
+        board.bleServer.setPmCharUpdateEnabled(newValue);
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d;te:%.1f;ps:%.1f",
+             (int)board.bleServer.pmCharUpdateEnabled,
+             board.power.torqueEffectiveness,
+             board.power.pedalSmoothness);
+    msg->replyAppend(buf);
+    return success();
+}
+
+// get/set optional CPM fields: cpm[=bits] -> bits
+// 1: accumulated torque, 2: extreme force magnitudes, 4: extreme angles, 8: dead spot angles
+// the angles are only sent while the crank angle is measured by the gyro (mdm 3 or 4)
+Api::Result *Api::cpmFieldsProcessor(Message *msg) {
+    if (0 < strlen(msg->arg)) {
+        int newValue = atoi(msg->arg);
+        if (!isdigit(msg->arg[0]) || newValue < 0 || CPM_FIELDS_ALL < newValue)
+            return argInvalid();
+        board.bleServer.setCpmFields((uint8_t)newValue);
+    }
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%d", board.bleServer.cpmFields);
+    msg->replyAppend(buf);
+    return success();
+}
+
+// get/set notification gates: gate[=name:deadband:heartbeatMs]
+// -> name:deadband:heartbeatMs:passed:suppressed;...
+// names: cpm (W), cscm (revolutions), wm (kg), hall, pm (%), heartbeat 0: none
+Api::Result *Api::notifyGateProcessor(Message *msg) {
+    if (0 < strlen(msg->arg)) {
+        char name[8] = "";
+        float deadband;
+        ulong heartbeatMs;
+        if (3 != sscanf(msg->arg, "%7[^:]:%f:%lu", name, &deadband, &heartbeatMs))
+            return argInvalid();
+        uint8_t gate = 0;
+        while (gate < BLE_GATES && 0 != strcmp(name, board.bleServer.gateStr(gate))) gate++;
+        if (!board.bleServer.setGate(gate, deadband, heartbeatMs)) return argInvalid();
+    }
+    for (uint8_t i = 0; i < BLE_GATES; i++) {
+        const NotifyGate *g = &board.bleServer.gates[i];
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s%s:%.3f:%lu:%lu:%lu",
+                 0 < i ? ";" : "", board.bleServer.gateStr(i), g->deadband,
+                 (ulong)g->heartbeatMs, (ulong)g->passed, (ulong)g->suppressed);
+        msg->replyAppend(buf);
+    }
+    return success();
+}
+
+// get/set strain stream char mode: ss[=0|1|2] -> 0|1|2;dropped:uint
+// 0: off, 1: strain, 2: strain and crank angle
+Api::Result *Api::strainStreamProcessor(Message *msg) {
+    if (0 < strlen(msg->arg)) {
+        int newValue = atoi(msg->arg);
+        if (newValue < 0 || STRAIN_STREAM_MAX <= newValue || !isdigit(msg->arg[0]))
+            return argInvalid();
+        board.bleServer.setStrainStreamMode((uint8_t)newValue);
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d;dropped:%lu",
+             board.bleServer.strainStreamMode,
+             (ulong)board.bleServer.strainStream.dropped);
+    msg->replyAppend(buf);
+    return success();
+}
+
+// get/set connection parameter profile: conn[=auto|idle|ride|stream]
+// -> mode;handle:profile:interval:latency:timeout;...
+// interval in ms, timeout in ms, profile -1: not requested yet
+Api::Result *Api::connectionProcessor(Message *msg) {
+    if (0 < strlen(msg->arg)) {
+        if (msg->argIs("auto"))
+            board.bleServer.setConnProfileMode(BLE_CONN_AUTO);
+        else if (msg->argIs("idle"))
+            board.bleServer.setConnProfileMode(BLE_CONN_IDLE);
+        else if (msg->argIs("ride"))
+            board.bleServer.setConnProfileMode(BLE_CONN_RIDE);
+        else if (msg->argIs("stream"))
+            board.bleServer.setConnProfileMode(BLE_CONN_STREAM);
+        else
+            return argInvalid();
+    }
+    static const char *modes[] = {"idle", "ride", "stream"};
+    const uint8_t mode = board.bleServer.connProfileMode;
+    msg->replyAppend(BLE_CONN_AUTO == mode ? "auto" : modes[mode]);
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++) {
+        const BleServer::Connection *c = &board.bleServer.connections[i];
+        if (BLE_HS_CONN_HANDLE_NONE == c->handle) continue;
+        char buf[48];
+        snprintf(buf, sizeof(buf), ";%d:%d:%.2f:%d:%d",
+                 c->handle,
+                 BLE_CONN_NONE == c->profile ? -1 : c->profile,
+                 c->interval * 1.25f,
+                 c->latency,
+                 c->timeout * 10);
+        msg->replyAppend(buf);
+    }
+    return success();
+}
+
+// get/set strain sample rate mode: sps[=auto|10|80] -> auto|10|80|fixed;sps:float
+// fixed: no rate pin is wired, the mode can not be set
+Api::Result *Api::strainRateProcessor(Message *msg) {
+    Api::Result *result = success();
+    if (0 < strlen(msg->arg)) {
+        uint8_t mode = STRAIN_RATE_MAX;
+        if (msg->argIs("auto"))
+            mode = STRAIN_RATE_AUTO;
+        else if (msg->argIs("10"))
+            mode = STRAIN_RATE_SLOW;
+        else if (msg->argIs("80"))
+            mode = STRAIN_RATE_FAST;
+        if (board.strain.setRateMode(mode))
+            board.strain.saveSettings();
+        else
+            result = argInvalid();
+    }
+    const char *modes[] = {"auto", "10", "80"};
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%s;sps:%.1f",
+             board.strain.hasRatePin() ? modes[board.strain.rateMode] : "fixed",
+             board.strain.sps);
+    msg->replyAppend(buf);
+    return result;
+}
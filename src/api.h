@@ -22,6 +22,7 @@ class Api : public Atoll::Api {
     static Result *reverseStrainProcessor(Message *);
     static Result *doublePowerProcessor(Message *);
     static Result *sleepDelayProcessor(Message *);
+    static Result *idleDelayProcessor(Message *);
     static Result *hallCharProcessor(Message *);
     static Result *hallOffsetProcessor(Message *);
     static Result *hallThresholdProcessor(Message *);
@@ -30,12 +31,23 @@ class Api : public Atoll::Api {
     static Result *strainThresLowProcessor(Message *);
     static Result *motionDetectionMethodProcessor(Message *);
     static Result *sleepProcessor(Message *);
+    static Result *bootProcessor(Message *);
+    static Result *taskProcessor(Message *);
     static Result *negativeTorqueMethodProcessor(Message *);
     static Result *autoTareProcessor(Message *);
     static Result *autoTareDelayMsProcessor(Message *);
     static Result *autoTareRangeGProcessor(Message *);
+    static Result *pedalMetricsProcessor(Message *);
+    static Result *cpmFieldsProcessor(Message *);
+    static Result *strainStreamProcessor(Message *);
+    static Result *notifyGateProcessor(Message *);
+    static Result *connectionProcessor(Message *);
+    static Result *strainRateProcessor(Message *);
 #ifdef FEATURE_MPU
     static Result *mpuLogIntervalProcessor(Message *);
+    static Result *mpuFifoProcessor(Message *);
+    static Result *mpuAdaptiveRateProcessor(Message *);
+    static Result *fusionProcessor(Message *);
 #endif
 };
 
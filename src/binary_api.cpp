@@ -0,0 +1,367 @@
+#include "binary_api.h"
+#include "board.h"
+
+#define BA_SAVE_BOARD (1 << 0)
+#define BA_SAVE_POWER (1 << 1)
+#define BA_SAVE_STRAIN (1 << 2)
+
+uint16_t BinaryApi::process() {
+    const uint8_t command = _request[0];
+    _response[0] = command;
+    _responseLen = 2;
+    _sent = 0;
+    _nextFragment = 0;
+    _responding = true;
+    uint8_t status = BA_UNKNOWN_COMMAND;
+    if (_overflow)
+        status = BA_FAILED;
+    else
+        switch (command) {
+            case BA_CMD_GET:
+            case BA_CMD_SET:
+                status = _settings(BA_CMD_SET == command);
+                break;
+            case BA_CMD_TARE:
+                status = _tare();
+                break;
+            case BA_CMD_TC_GET:
+            case BA_CMD_TC_SET:
+                status = _tc(BA_CMD_TC_SET == command);
+                break;
+            case BA_CMD_CURVE_GET:
+            case BA_CMD_CURVE_SET:
+                status = _curve(BA_CMD_CURVE_SET == command);
+                break;
+            case BA_CMD_STATS:
+                status = _stats();
+                break;
+        }
+    _response[1] = status;
+    log_d("command 0x%02x status %d response %d bytes", command, status, _responseLen);
+    return _connHandle;
+}
+
+// Adds the value of the setting to the response, returns false for an unknown tag.
+bool BinaryApi::_get(uint8_t tag) {
+    BleServer *ble = &board.bleServer;
+    switch (tag) {
+        case BA_CRANK_LENGTH:
+            _putFloat(tag, board.power.crankLength);
+            break;
+        case BA_SLEEP_DELAY:
+            _putU32(tag, board.sleepDelay);
+            break;
+        case BA_IDLE_DELAY:
+            _putU32(tag, board.idleDelay);
+            break;
+        case BA_MDM:
+            _putU8(tag, board.motionDetectionMethod);
+            break;
+        case BA_REVERSE_STRAIN:
+            _putU8(tag, board.power.reverseStrain);
+            break;
+        case BA_DOUBLE_POWER:
+            _putU8(tag, board.power.reportDouble);
+            break;
+        case BA_NTM:
+            _putU8(tag, board.strain.negativeTorqueMethod);
+            break;
+        case BA_AUTO_TARE:
+            _putU8(tag, board.strain.getAutoTare());
+            break;
+        case BA_AUTO_TARE_DELAY:
+            _putU32(tag, board.strain.getAutoTareDelayMs());
+            break;
+        case BA_AUTO_TARE_RANGE:
+            _putU16(tag, board.strain.getAutoTareRangeG());
+            break;
+        case BA_STRAIN_RATE:
+            _putU8(tag, board.strain.hasRatePin() ? board.strain.rateMode : STRAIN_RATE_FIXED);
+            break;
+        case BA_WM_MODE:
+            _putU8(tag, ble->wmCharMode);
+            break;
+        case BA_CADENCE_IN_CPM:
+            _putU8(tag, ble->cadenceInCpm);
+            break;
+        case BA_CPM_FIELDS:
+            _putU8(tag, ble->cpmFields);
+            break;
+        case BA_STRAIN_STREAM:
+            _putU8(tag, ble->strainStreamMode);
+            break;
+        case BA_CONN_PROFILE:
+            _putU8(tag, ble->connProfileMode);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// Sets a setting with the limits of the text API, returns false if the value is invalid.
+bool BinaryApi::_set(const Value *v) {
+    if (!v->isNumber()) return false;
+    const int32_t i = v->toInt();
+    BleServer *ble = &board.bleServer;
+    switch (v->tag) {
+        case BA_CRANK_LENGTH: {
+            const float f = v->toFloat();
+            if (f <= 10 || 2000 <= f) return false;
+            board.power.crankLength = f;
+            _save |= BA_SAVE_POWER;
+            break;
+        }
+        case BA_SLEEP_DELAY:
+            if ((uint32_t)i < SLEEP_DELAY_MIN) return false;
+            board.sleepDelay = (uint32_t)i;
+            _save |= BA_SAVE_BOARD;
+            break;
+        case BA_IDLE_DELAY:
+            if (0 != i && i <= IDLE_WAKE_PERIOD_MS) return false;
+            board.idleDelay = (ulong)i;
+            _save |= BA_SAVE_BOARD;
+            break;
+        case BA_MDM:
+            if (i < 0 || MDM_MAX <= i) return false;
+            board.setMotionDetectionMethod(i);
+            _save |= BA_SAVE_BOARD;
+            break;
+        case BA_REVERSE_STRAIN:
+            if (i < 0 || 1 < i) return false;
+            board.power.reverseStrain = i;
+            _save |= BA_SAVE_POWER;
+            break;
+        case BA_DOUBLE_POWER:
+            if (i < 0 || 1 < i) return false;
+            board.power.reportDouble = i;
+            _save |= BA_SAVE_POWER;
+            break;
+        case BA_NTM:
+            if (i < 0 || NTM_MAX <= i) return false;
+            board.strain.negativeTorqueMethod = i;
+            _save |= BA_SAVE_STRAIN;
+            break;
+        case BA_AUTO_TARE:
+            if (i < 0 || 1 < i) return false;
+            board.strain.setAutoTare(i);
+            _save |= BA_SAVE_STRAIN;
+            break;
+        case BA_AUTO_TARE_DELAY:
+            if (i <= 10 || 10000 <= i) return false;
+            board.strain.setAutoTareDelayMs(i);
+            _save |= BA_SAVE_STRAIN;
+            break;
+        case BA_AUTO_TARE_RANGE:
+            if (i <= 10 || 10000 <= i) return false;
+            board.strain.setAutoTareRangeG(i);
+            _save |= BA_SAVE_STRAIN;
+            break;
+        case BA_STRAIN_RATE:
+            if (i < 0 || STRAIN_RATE_MAX <= i || !board.strain.setRateMode(i)) return false;
+            _save |= BA_SAVE_STRAIN;
+            break;
+        case BA_WM_MODE:
+            if (i < 0 || WM_MAX <= i) return false;
+            ble->setWmCharMode(i);
+            if (WM_OFF == i) ble->setWmValue(0.0F);
+            break;
+        case BA_CADENCE_IN_CPM:
+            if (i < 0 || 1 < i) return false;
+            ble->setCadenceInCpm(i);
+            break;
+        case BA_CPM_FIELDS:
+            if (i < 0 || CPM_FIELDS_ALL < i) return false;
+            ble->setCpmFields(i);
+            break;
+        case BA_STRAIN_STREAM:
+            if (i < 0 || STRAIN_STREAM_MAX <= i) return false;
+            ble->setStrainStreamMode(i);
+            break;
+        case BA_CONN_PROFILE:
+            if (i < 0 || (BLE_CONN_PROFILES <= i && BLE_CONN_AUTO != i)) return false;
+            ble->setConnProfileMode(i);
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// get: [tag...] -> settings, no tags: all settings
+// set: setting... -> the resulting values, the modules are saved once
+uint8_t BinaryApi::_settings(bool set) {
+    uint8_t status = BA_SUCCESS;
+    uint16_t offset = 1;
+    Value v;
+    if (!set && _requestLen <= offset) {
+        for (uint8_t tag = 1; tag < BA_SETTINGS; tag++) _get(tag);
+        return status;
+    }
+    _save = 0;
+    while (_next(&offset, &v)) {
+        if (set && !_set(&v)) status = BA_INVALID_PARAMETER;
+        if (!_get(v.tag)) status = BA_INVALID_PARAMETER;
+    }
+    if (offset < _requestLen) status = BA_INVALID_PARAMETER;
+    if (_save & BA_SAVE_BOARD) board.saveSettings();
+    if (_save & BA_SAVE_POWER) board.power.saveSettings();
+    if (_save & BA_SAVE_STRAIN) board.strain.saveSettings();
+    return status;
+}
+
+uint8_t BinaryApi::_tare() {
+    const float force = board.strain.liveValue() * 9.80665f;
+    board.strain.tare();
+    _putFloat(BA_TARE_FORCE, force);
+    return BA_SUCCESS;
+}
+
+// get: [from], [count] -> enabled, size, key offset, key res, value res, from, values
+// set: [enabled], [from, values] -> as get, values from from
+// Without count as many values are sent as fit in the response.
+uint8_t BinaryApi::_tc(bool set) {
+#ifdef FEATURE_TEMPERATURE_COMPENSATION
+    TemperatureCompensation *tc = &board.tc;
+    uint8_t status = BA_SUCCESS;
+    uint16_t from = 0;
+    int32_t count = -1;
+    const Value *values = nullptr;
+    uint16_t offset = 1;
+    Value v;
+    Value valuesTlv;
+    bool changed = false;
+    while (_next(&offset, &v)) {
+        if (BA_TC_FROM == v.tag && v.isNumber() && 0 <= v.toInt() && v.toInt() < tc->getSize())
+            from = v.toInt();
+        else if (BA_TC_COUNT == v.tag && v.isNumber() && 0 <= v.toInt())
+            count = v.toInt();
+        else if (set && BA_TC_ENABLED == v.tag && v.isNumber() && 0 <= v.toInt() && v.toInt() <= 1) {
+            if (tc->enabled != (bool)v.toInt()) changed = true;
+            tc->enabled = v.toInt();
+        } else if (set && BA_TC_VALUES == v.tag && BA_BYTES == v.type) {
+            valuesTlv = v;
+            values = &valuesTlv;
+        } else
+            status = BA_INVALID_PARAMETER;
+    }
+    if (nullptr != values) {
+        if (tc->getSize() < from + values->len) {
+            status = BA_INVALID_PARAMETER;
+        } else {
+            for (uint16_t i = 0; i < values->len; i++) {
+                const int8_t value = (int8_t)values->data[i];
+                if (tc->getValue(from + i) != value) changed = true;
+                tc->setValue(from + i, value);
+            }
+            if (-1 == count) count = values->len;
+        }
+    }
+    if (changed) tc->saveSettings();
+    _putU8(BA_TC_ENABLED, tc->enabled);
+    _putU16(BA_TC_SIZE, tc->getSize());
+    _putI16(BA_TC_KEY_OFFSET, tc->getKeyOffset());
+    _putFloat(BA_TC_KEY_RES, tc->getKeyResolution());
+    _putFloat(BA_TC_VALUE_RES, tc->getValueResolution());
+    _putU16(BA_TC_FROM, from);
+    const int32_t fit = (int32_t)sizeof(_response) - _responseLen - 4;
+    if (-1 == count || fit < count) count = fit;
+    if (tc->getSize() - from < count) count = tc->getSize() - from;
+    if (count < 0) return BA_FAILED;
+    _put(BA_TC_VALUES, BA_BYTES, nullptr, 0);
+    uint8_t *d = _response + _responseLen - 4;  // values are written in place
+    d[2] = count & 0xff;
+    d[3] = (count >> 8) & 0xff;
+    for (uint16_t i = 0; i < count; i++)
+        _response[_responseLen++] = (uint8_t)tc->getValue(from + i);
+    return status;
+#else
+    return BA_NOT_SUPPORTED;
+#endif
+}
+
+// get: [channel] -> channel, mode, points
+// set: [channel], [points], [mode] -> as get, points are set before the mode
+uint8_t BinaryApi::_curve(bool set) {
+    uint8_t status = BA_SUCCESS;
+    uint8_t channel = STRAIN_RIGHT;
+    int16_t mode = -1;
+    Value points;
+    bool hasPoints = false;
+    uint16_t offset = 1;
+    Value v;
+    while (_next(&offset, &v)) {
+        if (BA_CURVE_CHANNEL == v.tag && v.isNumber() && 0 <= v.toInt() && v.toInt() < board.strain.numChannels())
+            channel = v.toInt();
+        else if (set && BA_CURVE_MODE == v.tag && v.isNumber() && 0 <= v.toInt() && v.toInt() < STRAIN_CURVE_MAX)
+            mode = v.toInt();
+        else if (set && BA_CURVE_POINTS == v.tag && BA_BYTES == v.type) {
+            points = v;
+            hasPoints = true;
+        } else
+            status = BA_INVALID_PARAMETER;
+    }
+    StrainCurve *curve = &board.strain.channels[channel].curve;
+    if (set && BA_SUCCESS == status && (hasPoints || 0 <= mode)) {
+        if (hasPoints) {
+            if (0 == points.len)
+                board.strain.clearCurve(channel);
+            else if (!curve->setBytes(points.data, points.len))
+                status = BA_INVALID_PARAMETER;
+        }
+        if (0 <= mode && !board.strain.setCurveMode(mode, channel))
+            status = BA_FAILED;
+        board.strain.saveSettings();
+    }
+    _putU8(BA_CURVE_CHANNEL, channel);
+    _putU8(BA_CURVE_MODE, curve->getMode());
+    _put(BA_CURVE_POINTS, BA_BYTES, curve->bytes(), curve->bytesSize());
+    return status;
+}
+
+// [reset] -> uptime, heap, strain stream dropped, gates, fusion, connections
+uint8_t BinaryApi::_stats() {
+    uint8_t status = BA_SUCCESS;
+    bool resetCounters = false;
+    uint16_t offset = 1;
+    Value v;
+    while (_next(&offset, &v)) {
+        if (BA_STATS_RESET == v.tag && v.isNumber())
+            resetCounters = 1 == v.toInt();
+        else
+            status = BA_INVALID_PARAMETER;
+    }
+    BleServer *ble = &board.bleServer;
+    _putU32(BA_STATS_UPTIME, millis());
+    _putU32(BA_STATS_HEAP, esp_get_free_heap_size());
+    _putU32(BA_STATS_SS_DROPPED, ble->strainStream.dropped);
+    uint32_t gates[BLE_GATES * 2];
+    for (uint8_t i = 0; i < BLE_GATES; i++) {
+        gates[i * 2] = ble->gates[i].passed;
+        gates[i * 2 + 1] = ble->gates[i].suppressed;
+    }
+    _put(BA_STATS_GATES, BA_BYTES, gates, sizeof(gates));
+    const CrankFusion::Counters *c = &board.strain.fusion.counters;
+    const uint32_t fusion[4] = {c->accepted, c->filled, c->rejectedStill, c->rejectedEarly};
+    _put(BA_STATS_FUSION, BA_BYTES, fusion, sizeof(fusion));
+    uint16_t conns[BLE_SERVER_MAX_CONNECTIONS * 4];
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++) {
+        const BleServer::Connection *conn = &ble->connections[i];
+        if (BLE_HS_CONN_HANDLE_NONE == conn->handle) continue;
+        conns[n++] = conn->handle;
+        conns[n++] = conn->interval;
+        conns[n++] = conn->latency;
+        conns[n++] = conn->timeout;
+    }
+    _put(BA_STATS_CONNECTIONS, BA_BYTES, conns, n * sizeof(uint16_t));
+    if (resetCounters) {
+        ble->strainStream.dropped = 0;
+        for (uint8_t i = 0; i < BLE_GATES; i++) {
+            ble->gates[i].passed = 0;
+            ble->gates[i].suppressed = 0;
+        }
+        board.strain.fusion.resetCounters();
+    }
+    return status;
+}
@@ -0,0 +1,168 @@
+#ifndef BINARY_API_H
+#define BINARY_API_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#ifndef BINARY_API_MESSAGE_MAX
+#define BINARY_API_MESSAGE_MAX 512  // maximum size of a reassembled request or response
+#endif
+#ifndef BINARY_API_FRAME_MAX
+#define BINARY_API_FRAME_MAX 509  // CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU - 3
+#endif
+
+// Frame: [seq: 1][fragment: 1][payload]
+// fragment: bits 0..6: index of the fragment in the message, bit 7: last fragment
+// A message is split into fragments that fit in a notification or a write,
+// the response carries the sequence number of the request. A response that
+// can not be sent completely is restarted as [command][BA_FAILED] in a
+// single frame with index 0.
+#define BA_FRAGMENT_LAST 0x80
+#define BA_FRAGMENT_INDEX 0x7f
+#define BA_FRAME_HEADER 2
+
+// Request: [command: 1][TLV...]
+// Response: [command: 1][status: 1][TLV...]
+// TLV: [tag: 1][type: 1][length: 2][value: length]
+// All values are little endian.
+#define BA_CMD_GET 0x01         // request: tags to get, no tags: all settings, response: settings
+#define BA_CMD_SET 0x02         // request: settings, response: the resulting values of the settings
+#define BA_CMD_TARE 0x03        // response: BA_TARE_FORCE
+#define BA_CMD_TC_GET 0x10      // request: [from], [count], response: table params, from, values
+#define BA_CMD_TC_SET 0x11      // request: [enabled], [from, values], response: as BA_CMD_TC_GET
+#define BA_CMD_CURVE_GET 0x20   // request: [channel], response: channel, mode, points
+#define BA_CMD_CURVE_SET 0x21   // request: [channel], [mode], [points], response: as BA_CMD_CURVE_GET
+#define BA_CMD_STATS 0x30       // request: [reset], response: counters
+
+#define BA_SUCCESS 0x00
+#define BA_UNKNOWN_COMMAND 0x01
+#define BA_INVALID_PARAMETER 0x02  // the response holds the values of the valid parameters
+#define BA_FAILED 0x03
+#define BA_NOT_SUPPORTED 0x04      // feature not compiled in
+
+// value types
+#define BA_NONE 0x00  // no value, e.g. a tag in a get request
+#define BA_U8 0x01
+#define BA_I8 0x02
+#define BA_U16 0x03
+#define BA_I16 0x04
+#define BA_U32 0x05
+#define BA_I32 0x06
+#define BA_FLOAT 0x07
+#define BA_BYTES 0x08
+#define BA_STR 0x09
+
+// settings, BA_CMD_GET and BA_CMD_SET
+#define BA_CRANK_LENGTH 0x01     // float, mm
+#define BA_SLEEP_DELAY 0x02      // u32, ms
+#define BA_IDLE_DELAY 0x03       // u32, ms, 0: disabled
+#define BA_MDM 0x04              // u8, MDM_*
+#define BA_REVERSE_STRAIN 0x05   // u8, 0|1
+#define BA_DOUBLE_POWER 0x06     // u8, 0|1
+#define BA_NTM 0x07              // u8, NTM_*
+#define BA_AUTO_TARE 0x08        // u8, 0|1
+#define BA_AUTO_TARE_DELAY 0x09  // u32, ms
+#define BA_AUTO_TARE_RANGE 0x0a  // u16, g
+#define BA_STRAIN_RATE 0x0b      // u8, STRAIN_RATE_*, STRAIN_RATE_FIXED if no rate pin is wired
+#define BA_WM_MODE 0x0c          // u8, WM_*
+#define BA_CADENCE_IN_CPM 0x0d   // u8, 0|1
+#define BA_CPM_FIELDS 0x0e       // u8, CPM_FIELD_* bits
+#define BA_STRAIN_STREAM 0x0f    // u8, STRAIN_STREAM_*
+#define BA_CONN_PROFILE 0x10     // u8, BLE_CONN_* or BLE_CONN_AUTO
+#define BA_SETTINGS 0x11         // marks the high limit
+
+// temperature compensation table, BA_CMD_TC_*
+#define BA_TC_ENABLED 0x20       // u8, 0|1
+#define BA_TC_SIZE 0x21          // u16
+#define BA_TC_KEY_OFFSET 0x22    // i16, ˚C
+#define BA_TC_KEY_RES 0x23       // float, ˚C
+#define BA_TC_VALUE_RES 0x24     // float, kg
+#define BA_TC_FROM 0x25          // u16, index of the first value
+#define BA_TC_COUNT 0x26         // u16, number of values requested
+#define BA_TC_VALUES 0x27        // bytes, int8 values from BA_TC_FROM
+
+// calibration curve, BA_CMD_CURVE_*
+#define BA_CURVE_CHANNEL 0x30    // u8, STRAIN_RIGHT or STRAIN_LEFT
+#define BA_CURVE_MODE 0x31       // u8, STRAIN_CURVE_*
+#define BA_CURVE_POINTS 0x32     // bytes, [raw: i32][grams: i32] per point
+
+// tare, BA_CMD_TARE
+#define BA_TARE_FORCE 0x38       // float, force in N before taring
+
+// statistics, BA_CMD_STATS
+#define BA_STATS_RESET 0x40       // u8, 1: reset the counters after reading
+#define BA_STATS_UPTIME 0x41      // u32, ms
+#define BA_STATS_HEAP 0x42        // u32, free heap in bytes
+#define BA_STATS_SS_DROPPED 0x43  // u32, strain stream packets dropped
+#define BA_STATS_GATES 0x44       // bytes, [passed: u32][suppressed: u32] per gate, BLE_GATE_* order
+#define BA_STATS_FUSION 0x45      // bytes, [accepted][filled][rejected still][rejected early]: u32
+#define BA_STATS_CONNECTIONS 0x46 // bytes, [handle: u16][interval: u16][latency: u16][timeout: u16] per connection
+
+// Binary framed API over BLE alongside the text API: the same settings as
+// typed values, and payloads larger than a text reply, e.g. the temperature
+// compensation table, in one request. Fragments are reassembled by onWrite()
+// in the BLE host task, the request is executed by process() outside of it.
+// One request is handled at a time, fragments of other requests are dropped
+// until the response is sent.
+class BinaryApi {
+   public:
+    // Reads a typed TLV value.
+    struct Value {
+        uint8_t tag;
+        uint8_t type;
+        uint16_t len;
+        const uint8_t *data;
+
+        bool isNumber() const;
+        int32_t toInt() const;
+        float toFloat() const;
+    };
+
+    // Adds a fragment written by the connection, returns true when the request is complete.
+    bool onWrite(uint16_t connHandle, const uint8_t *data, size_t len);
+    bool pending();
+    // Executes the request, returns the connection to send the response to.
+    uint16_t process();
+    // Returns the next frame of the response, at most size long, nullptr when done.
+    const uint8_t *frame(uint16_t size, uint16_t *len);
+    // Returns a frame replacing the rest of the response with BA_FAILED, ends the response.
+    const uint8_t *failed(uint16_t *len);
+    void reset();
+
+   protected:
+    uint8_t _request[BINARY_API_MESSAGE_MAX];
+    uint16_t _requestLen = 0;
+    uint8_t _response[BINARY_API_MESSAGE_MAX];
+    uint8_t _frame[BINARY_API_FRAME_MAX];
+    uint16_t _responseLen = 0;
+    uint16_t _sent = 0;           // bytes of the response already fragmented
+    uint16_t _connHandle = 0xffff;
+    uint8_t _seq = 0;
+    uint8_t _nextFragment = 0;    // index of the expected request or of the next response fragment
+    bool _overflow = false;       // the request did not fit, its fragments are discarded
+    uint8_t _save = 0;            // modules to save after setting values, BA_SAVE_* bits
+    volatile bool _pending = false;  // a complete request waits to be processed or its response to be sent
+    bool _responding = false;        // the request is processed, its response is being sent
+
+    bool _next(uint16_t *offset, Value *v);
+    bool _get(uint8_t tag);
+    bool _set(const Value *v);
+    void _put(uint8_t tag, uint8_t type, const void *data, uint16_t len);
+    void _putU8(uint8_t tag, uint8_t value);
+    void _putU16(uint8_t tag, uint16_t value);
+    void _putI16(uint8_t tag, int16_t value);
+    void _putU32(uint8_t tag, uint32_t value);
+    void _putFloat(uint8_t tag, float value);
+
+    uint8_t _settings(bool set);
+    uint8_t _tare();
+    uint8_t _tc(bool set);
+    uint8_t _curve(bool set);
+    uint8_t _stats();
+};
+
+#endif
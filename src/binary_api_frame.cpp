@@ -0,0 +1,189 @@
+#include "binary_api.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifndef ARDUINO
+#define log_e(...)
+#endif
+
+// Framing and TLV encoding of the binary api, no dependencies on the board,
+// so it can be tested on the host. The commands are in binary_api.cpp.
+
+static uint8_t typeSize(uint8_t type) {
+    switch (type) {
+        case BA_U8:
+        case BA_I8:
+            return 1;
+        case BA_U16:
+        case BA_I16:
+            return 2;
+        case BA_U32:
+        case BA_I32:
+        case BA_FLOAT:
+            return 4;
+    }
+    return 0;
+}
+
+bool BinaryApi::Value::isNumber() const {
+    return 0 < typeSize(type) && typeSize(type) == len;
+}
+
+int32_t BinaryApi::Value::toInt() const {
+    switch (type) {
+        case BA_U8:
+            return data[0];
+        case BA_I8:
+            return (int8_t)data[0];
+        case BA_U16:
+            return (uint16_t)(data[0] | (data[1] << 8));
+        case BA_I16:
+            return (int16_t)(data[0] | (data[1] << 8));
+        case BA_U32:
+        case BA_I32:
+            return (int32_t)(data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24));
+        case BA_FLOAT:
+            return (int32_t)lroundf(toFloat());
+    }
+    return 0;
+}
+
+float BinaryApi::Value::toFloat() const {
+    if (BA_FLOAT != type) return (float)toInt();
+    float f;
+    memcpy(&f, data, sizeof(f));
+    return f;
+}
+
+bool BinaryApi::onWrite(uint16_t connHandle, const uint8_t *data, size_t len) {
+    if (len < BA_FRAME_HEADER) return false;
+    if (_pending) {
+        log_e("busy, fragment dropped");
+        return false;
+    }
+    const uint8_t index = data[1] & BA_FRAGMENT_INDEX;
+    if (0 == index) {
+        // a first fragment starts a new request
+        _connHandle = connHandle;
+        _seq = data[0];
+        _requestLen = 0;
+        _nextFragment = 0;
+        _overflow = false;
+    } else if (connHandle != _connHandle || data[0] != _seq || index != _nextFragment) {
+        log_e("unexpected fragment %d of seq %d", index, data[0]);
+        reset();
+        return false;
+    }
+    _nextFragment++;
+    len -= BA_FRAME_HEADER;
+    if (sizeof(_request) < _requestLen + len)
+        _overflow = true;
+    if (!_overflow) {
+        memcpy(_request + _requestLen, data + BA_FRAME_HEADER, len);
+        _requestLen += len;
+    }
+    if (!(data[1] & BA_FRAGMENT_LAST)) return false;
+    if (0 == _requestLen) {
+        reset();
+        return false;
+    }
+    _pending = true;
+    return true;
+}
+
+bool BinaryApi::pending() {
+    return _pending && !_responding;
+}
+
+const uint8_t *BinaryApi::frame(uint16_t size, uint16_t *len) {
+    if (sizeof(_frame) < size) size = sizeof(_frame);
+    if (!_responding || size <= BA_FRAME_HEADER || _responseLen <= _sent || BA_FRAGMENT_INDEX < _nextFragment) {
+        reset();
+        return nullptr;
+    }
+    uint16_t n = _responseLen - _sent;
+    if (size - BA_FRAME_HEADER < n) n = size - BA_FRAME_HEADER;
+    const bool last = _responseLen <= _sent + n;
+    _frame[0] = _seq;
+    _frame[1] = _nextFragment | (last ? BA_FRAGMENT_LAST : 0);
+    memcpy(_frame + BA_FRAME_HEADER, _response + _sent, n);
+    _sent += n;
+    _nextFragment++;
+    *len = n + BA_FRAME_HEADER;
+    return _frame;
+}
+
+// Returns a single frame replacing the response with [command][BA_FAILED],
+// e.g. when a frame could not be sent, and ends the response.
+const uint8_t *BinaryApi::failed(uint16_t *len) {
+    _frame[0] = _seq;
+    _frame[1] = BA_FRAGMENT_LAST;  // fragment 0: the client drops the fragments received so far
+    _frame[2] = _response[0];
+    _frame[3] = BA_FAILED;
+    *len = 4;
+    reset();
+    return _frame;
+}
+
+void BinaryApi::reset() {
+    _requestLen = 0;
+    _responseLen = 0;
+    _sent = 0;
+    _nextFragment = 0;
+    _overflow = false;
+    _connHandle = 0xffff;
+    _responding = false;
+    _pending = false;
+}
+
+// Reads the TLV at offset of the request and advances offset past it.
+bool BinaryApi::_next(uint16_t *offset, Value *v) {
+    if (_requestLen < *offset + 4) return false;
+    const uint8_t *d = _request + *offset;
+    v->tag = d[0];
+    v->type = d[1];
+    v->len = d[2] | (d[3] << 8);
+    v->data = d + 4;
+    if (_requestLen < *offset + 4 + v->len) return false;
+    *offset += 4 + v->len;
+    return true;
+}
+
+void BinaryApi::_put(uint8_t tag, uint8_t type, const void *data, uint16_t len) {
+    if (sizeof(_response) < (size_t)_responseLen + 4 + len) {
+        log_e("response full, tag 0x%02x dropped", tag);
+        return;
+    }
+    uint8_t *d = _response + _responseLen;
+    d[0] = tag;
+    d[1] = type;
+    d[2] = len & 0xff;
+    d[3] = (len >> 8) & 0xff;
+    if (0 < len) memcpy(d + 4, data, len);
+    _responseLen += 4 + len;
+}
+
+void BinaryApi::_putU8(uint8_t tag, uint8_t value) {
+    _put(tag, BA_U8, &value, 1);
+}
+
+void BinaryApi::_putU16(uint8_t tag, uint16_t value) {
+    uint8_t d[2] = {(uint8_t)(value & 0xff), (uint8_t)((value >> 8) & 0xff)};
+    _put(tag, BA_U16, d, sizeof(d));
+}
+
+void BinaryApi::_putI16(uint8_t tag, int16_t value) {
+    uint8_t d[2] = {(uint8_t)(value & 0xff), (uint8_t)((value >> 8) & 0xff)};
+    _put(tag, BA_I16, d, sizeof(d));
+}
+
+void BinaryApi::_putU32(uint8_t tag, uint32_t value) {
+    uint8_t d[4] = {(uint8_t)(value & 0xff), (uint8_t)((value >> 8) & 0xff),
+                    (uint8_t)((value >> 16) & 0xff), (uint8_t)((value >> 24) & 0xff)};
+    _put(tag, BA_U32, d, sizeof(d));
+}
+
+void BinaryApi::_putFloat(uint8_t tag, float value) {
+    _put(tag, BA_FLOAT, &value, sizeof(value));
+}
@@ -3,18 +3,44 @@
 
 #include "atoll_ble.h"
 
+// Connection parameter profiles, intervals in 1.25 ms, supervision timeout in 10 ms.
+static const struct {
+    uint16_t minInterval;
+    uint16_t maxInterval;
+    uint16_t latency;  // connection events the peripheral may skip
+    uint16_t timeout;
+} bleConnProfiles[BLE_CONN_PROFILES] = {
+    {80, 160, 4, 600},  // idle: 100-200 ms, 6 s
+    {24, 48, 0, 400},   // ride: 30-60 ms, 4 s
+    {12, 24, 0, 400},   // stream: 15-30 ms, 4 s
+};
+
 void BleServer::setup(const char *deviceName, ::Preferences *p) {
     Atoll::BleServer::setup(deviceName);
     preferencesSetup(p, "BLE");
     loadSettings();
     printSettings();
 
+    _cpcQueue = xQueueCreate(CPCP_QUEUE_LENGTH, sizeof(ControlPointRequest));
+    if (nullptr == _cpcQueue) log_e("could not create control point queue");
+
     startCpService();
     startCscService();
     startWsService();
 
     lastPowerNotification = millis();
     lastCadenceNotification = lastPowerNotification;
+
+    if (pdPASS != xTaskCreate(_senderTaskFn, "bleSender", BLE_SENDER_TASK_STACK,
+                              this, BLE_SENDER_TASK_PRIORITY, &_senderTask)) {
+        log_e("could not start sender task");
+        _senderTask = nullptr;
+    }
+    if (pdPASS != xTaskCreate(_requestTaskFn, "bleRequest", BLE_REQUEST_TASK_STACK,
+                              this, BLE_REQUEST_TASK_PRIORITY, &_requestTask)) {
+        log_e("could not start request task");
+        _requestTask = nullptr;
+    }
 }
 
 void BleServer::init() {
@@ -49,10 +75,12 @@ void BleServer::loop() {
     }
     Atoll::BleServer::loop();
     const ulong t = millis();
-    if (powerNotificationReady || lastPowerNotification < t - 1000)
-        notifyCp(t);
-    if (cadenceNotificationReady || lastCadenceNotification < t - 1500)
-        notifyCsc(t);
+    if (nullptr == _senderTask) {
+        if (powerNotificationReady || lastPowerNotification < t - BLE_CP_HEARTBEAT_MS)
+            notifyCp(t);
+        if (cadenceNotificationReady || lastCadenceNotification < t - BLE_CSC_HEARTBEAT_MS)
+            notifyCsc(t);
+    }
     if (lastWmNotification < t - 500) {
         if (wmCharMode == WM_ON ||              //
             (wmCharMode == WM_WHEN_NO_CRANK &&  //
@@ -66,6 +94,12 @@ void BleServer::loop() {
         setHallValue(board.motion.lastHallValue);
         lastHallNotification = t;
     }
+    if (pmCharUpdateEnabled && pmNotificationReady) {
+        setPmValue(board.power.torqueEffectiveness, board.power.pedalSmoothness);
+        pmNotificationReady = false;
+    }
+    if (nullptr == _requestTask) _processRequests();
+    _updateConnParams(t);
 }
 
 void BleServer::startCpService() {
@@ -74,23 +108,13 @@ void BleServer::startCpService() {
     cps = createService(cpsUUID);
 
     // Cycling Power Feature
-    BLECharacteristic *cpfChar = cps->createCharacteristic(
+    cpfChar = cps->createCharacteristic(
         BLEUUID(CYCLING_POWER_FEATURE_CHAR_UUID),
         BLE_PROP::READ
         //| BLE_PROP::READ_ENC
     );
     cpfChar->setCallbacks(this);
 
-    bufPowerFeature[0] = 0x00;
-    bufPowerFeature[1] = 0x00;
-    bufPowerFeature[2] = 0x00;
-    if (cadenceInCpm) {
-        bufPowerFeature[3] = 0b00001000;  // lsb #3: crank revolution data supported
-    } else {
-        bufPowerFeature[3] = 0x00;
-    }
-    cpfChar->setValue((uint8_t *)&bufPowerFeature, 4);
-
     // Cycling Power Measurement
     cpmChar = cps->createCharacteristic(
         BLEUUID(CYCLING_POWER_MEASUREMENT_CHAR_UUID),
@@ -98,24 +122,19 @@ void BleServer::startCpService() {
         //| BLE_PROP::INDICATE
     );
 
-    BLEDescriptor *cpmDesc = cpmChar->createDescriptor(
+    cpmDesc = cpmChar->createDescriptor(
         BLEUUID(CYCLING_POWER_MEASUREMENT_DESC_UUID),
         BLE_PROP::READ);
-    char s[SETTINGS_STR_LENGTH];
-    strncpy(s, cadenceInCpm ? "Power and cadence measurement" : "Power measurement", sizeof(s));
-    cpmDesc->setValue((uint8_t *)s, strlen(s));
+    updateCpFormat();
 
     cpmChar->setCallbacks(this);
     cps->start();
 
-    /*
-    BLECharacteristic *cpChar = cps->createCharacteristic(
-        BLEUUID(SC_CONTROL_POINT_CHAR_UUID),
-        BLE_PROP::READ | BLE_PROP::WRITE
-    );
-    bufControlPoint[0] = SC_CONTROL_POINT_OP_SET_CUMULATIVE_VALUE;
-    cpChar->setValue((uint8_t *)&bufControlPoint, 1);
-    */
+    // Cycling Power Control Point
+    cpcChar = cps->createCharacteristic(
+        BLEUUID(CPS_CONTROL_POINT_CHAR_UUID),
+        BLE_PROP::WRITE | BLE_PROP::INDICATE);
+    cpcChar->setCallbacks(this);
 
     // CPS Sensor Location
     BLECharacteristic *slChar = cps->createCharacteristic(
@@ -130,14 +149,40 @@ void BleServer::startCpService() {
     advertiseService(cpsUUID);
 }
 
+// Updates the CPS feature value, the CPM description and the CPM layouts from
+// the settings, the service keeps running.
+void BleServer::updateCpFormat() {
+    uint32_t features = 0;
+    if (1 < board.strain.numChannels()) features |= featureBalance;
+    if (cadenceInCpm) features |= featureCrankRevs;
+    const uint8_t fields = _cpmEffectiveFields();
+    if (fields & CPM_FIELD_ACC_TORQUE) features |= featureAccTorque;
+    if (fields & CPM_FIELD_EXTREME_FORCE) features |= featureExtremeMagnitudes;
+    if (fields & CPM_FIELD_EXTREME_ANGLES) features |= featureExtremeAngles;
+    if (fields & CPM_FIELD_DEAD_SPOTS) features |= featureDeadSpots;
+    _setupCpmLayouts();
+    features |= featureOffsetCompensation | featureCrankLength;
+    bufPowerFeature[0] = features & 0xff;  // little endian
+    bufPowerFeature[1] = (features >> 8) & 0xff;
+    bufPowerFeature[2] = (features >> 16) & 0xff;
+    bufPowerFeature[3] = (features >> 24) & 0xff;
+    if (nullptr != cpfChar) cpfChar->setValue((uint8_t *)&bufPowerFeature, 4);
+
+    if (nullptr == cpmDesc) return;
+    char s[SETTINGS_STR_LENGTH];
+    strncpy(s, cadenceInCpm ? "Power and cadence measurement" : "Power measurement", sizeof(s));
+    cpmDesc->setValue((uint8_t *)s, strlen(s));
+}
+
 void BleServer::stopCpService() {
     log_i("Stopping CPS");
     unAdvertiseService(cpsUUID);
     removeService(cps);
 }
 
+// The CSCS is always served, cscServiceActive only decides whether it is
+// advertised. Clients that find it can subscribe either way.
 void BleServer::startCscService() {
-    if (!cscServiceActive) return;
     log_i("Starting CSCS");
     cscsUUID = BLEUUID(CYCLING_SPEED_CADENCE_SERVICE_UUID);
     cscs = createService(cscsUUID);
@@ -169,13 +214,14 @@ void BleServer::startCscService() {
 
     cscmChar->setCallbacks(this);
     cscs->start();
-    advertiseService(cscsUUID);
+    if (cscServiceActive) advertiseService(cscsUUID);
 }
 
 void BleServer::stopCscService() {
     log_i("Stopping CSCS");
     unAdvertiseService(cscsUUID);
     removeService(cscs);
+    cscmChar = nullptr;
 }
 
 // Start Weight Scale service
@@ -216,74 +262,242 @@ void BleServer::startWsService() {
     advertiseService(wssUUID);
 }
 
-void BleServer::onCrankEvent(const ulong t, const uint16_t revolutions) {
+void BleServer::onCrankEvent(const int64_t us, const uint16_t revolutions) {
     if (crankRevs < revolutions) {
         crankRevs = revolutions;
-        lastCrankEventTime = (uint16_t)(t * 1.024);
+        lastCrankEventTime = Timebase::toCrankEventTime(us);
         cadenceNotificationReady = true;
         // notifyCsc(t);
     }
     powerNotificationReady = true;
-    // notifyCp(t);
+    pmNotificationReady = true;
+    if (nullptr != _senderTask) xTaskNotifyGive(_senderTask);
+}
+
+void BleServer::_senderTaskFn(void *arg) {
+    static_cast<BleServer *>(arg)->_senderLoop();
+}
+
+// CPM and CSCM notifications are sent from here only, the task sleeps until
+// woken by a crank event or until the next notification is due.
+void BleServer::_senderLoop() {
+    while (true) {
+        const bool sending = enabled && started;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(sending ? _senderWait(millis()) : BLE_CP_HEARTBEAT_MS));
+        if (!enabled || !started) continue;
+        const ulong t = millis();
+        if (powerNotificationReady || lastPowerNotification < t - BLE_CP_HEARTBEAT_MS)
+            notifyCp(t);
+        if (cadenceNotificationReady || lastCadenceNotification < t - BLE_CSC_HEARTBEAT_MS)
+            notifyCsc(t);
+        if (strainStream.pending()) notifyStrainStream();
+    }
+}
+
+void BleServer::_requestTaskFn(void *arg) {
+    static_cast<BleServer *>(arg)->_requestLoop();
+}
+
+// Requests may tare for seconds, write preferences or restart tasks, so they
+// are processed here instead of in the sender task, which has to keep up with
+// crank events. The task sleeps until onWrite() queues a request.
+void BleServer::_requestLoop() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!enabled || !started) continue;
+        _processRequests();
+    }
+}
+
+void BleServer::_processRequests() {
+    ControlPointRequest request;
+    while (nullptr != _cpcQueue && pdTRUE == xQueueReceive(_cpcQueue, &request, 0))
+        _processControlPoint(&request);
+    if (binaryApi.pending()) _processBinaryApi();
+}
+
+// Returns the time in ms until the next CPM or CSCM notification is due, a
+// pending crank event is held back until CRANK_EVENT_MIN_MS has passed.
+ulong BleServer::_senderWait(const ulong t) {
+    ulong due = lastPowerNotification +
+                (powerNotificationReady ? CRANK_EVENT_MIN_MS : BLE_CP_HEARTBEAT_MS);
+    if (hasSubscribers(BLE_SUB_CSCM)) {
+        ulong cadenceDue = lastCadenceNotification +
+                           (cadenceNotificationReady ? CRANK_EVENT_MIN_MS : BLE_CSC_HEARTBEAT_MS);
+        if (cadenceDue < due) due = cadenceDue;
+    }
+    if (due <= t) return 1;
+    return due - t;
 }
 
 // notify Cycling Power service
 void BleServer::notifyCp(const ulong t) {
-    powerNotificationReady = false;
     if (!enabled) {
+        powerNotificationReady = false;
         log_i("Not enabled, not notifying CP");
         return;
     }
-    if (t - CRANK_EVENT_MIN_MS < lastPowerNotification) return;
+    if (t - CRANK_EVENT_MIN_MS < lastPowerNotification) return;  // stays ready, sent when due
+    powerNotificationReady = false;
     lastPowerNotification = t;
-    static uint16_t prevPower = 0;
+    if (nullptr == cpmChar || !hasSubscribers(BLE_SUB_CPM)) return;  // not encoded without subscribers
+    static uint16_t prevRevs = 0;
     power = (uint16_t)board.getPower();
-    if (power == prevPower) {
+    const bool newRevs = cadenceInCpm && crankRevs != prevRevs;
+    if (!gates[BLE_GATE_CPM].pass(power, t, newRevs)) {
         // log_i("Power not changed, not notifying CP");
         return;
     }
-    prevPower = power;
-    if (cadenceInCpm) {
-        bufPower[0] = powerFlagsWithCadence & 0xff;
-        bufPower[1] = (powerFlagsWithCadence >> 8) & 0xff;
-    } else {
-        bufPower[0] = powerFlags & 0xff;
-        bufPower[1] = (powerFlags >> 8) & 0xff;
-    }
-    bufPower[2] = power & 0xff;
-    bufPower[3] = (power >> 8) & 0xff;
-    if (cadenceInCpm) {
-        bufPower[4] = crankRevs & 0xff;
-        bufPower[5] = (crankRevs >> 8) & 0xff;
-        bufPower[6] = lastCrankEventTime & 0xff;
-        bufPower[7] = (lastCrankEventTime >> 8) & 0xff;
-        cpmChar->setValue((uint8_t *)&bufPower, 8);
-    } else {
-        cpmChar->setValue((uint8_t *)&bufPower, 4);
-    }
+    prevRevs = crankRevs;
+    const uint8_t withBalance = 0.0 <= board.power.balance ? 1 : 0;
+    const uint8_t len = _encodeCp(&_cpmLayouts[withBalance][0], bufPower);
+    bufPowerLength = len;
     // log_i("Notifying power %d", power);
-    cpmChar->notify();
+    // a connection with a small MTU gets the packet without the optional
+    // fields, encoded only if such a connection is subscribed
+    uint8_t compact[CPM_LENGTH_MAX + CPM_SCRATCH];
+    uint8_t compactLen = 0;
+    BLEServer *server = BLEDevice::getServer();
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++) {
+        const Connection *conn = &connections[i];
+        if (BLE_HS_CONN_HANDLE_NONE == conn->handle || !((conn->notify | conn->indicate) & BLE_SUB_CPM)) continue;
+        uint16_t mtu = nullptr == server ? 0 : server->getPeerMTU(conn->handle);
+        if (mtu < BLE_ATT_MTU_DFLT) mtu = BLE_ATT_MTU_DFLT;
+        const uint8_t *data = bufPower;
+        uint8_t dataLen = len;
+        if (mtu - 3 < len) {
+            if (0 == compactLen) compactLen = _encodeCp(&_cpmLayouts[withBalance][1], compact);
+            data = compact;
+            dataLen = compactLen;
+        }
+        if (conn->notify & BLE_SUB_CPM)
+            cpmChar->notify(data, dataLen, conn->handle);
+        else
+            cpmChar->indicate(data, dataLen, conn->handle);
+    }
+    static bool first = true;
+    if (first) {
+        board.bootProfile.mark("firstCpm");
+        first = false;
+    }
+}
+
+// Encodes the CPM packet with the layout into b, returns its length.
+uint8_t BleServer::_encodeCp(const CpmLayout *l, uint8_t *b) {
+    const float balance = board.power.balance;
+    Power *p = &board.power;
+    b[0] = l->flags & 0xff;
+    b[1] = (l->flags >> 8) & 0xff;
+    b[2] = power & 0xff;
+    b[3] = (power >> 8) & 0xff;
+    b[l->balance] = (uint8_t)(balance * 2);  // 1/2 %
+    b[l->accTorque] = p->accumulatedTorque & 0xff;
+    b[l->accTorque + 1] = (p->accumulatedTorque >> 8) & 0xff;
+    b[l->crankRevs] = crankRevs & 0xff;
+    b[l->crankRevs + 1] = (crankRevs >> 8) & 0xff;
+    b[l->crankRevs + 2] = lastCrankEventTime & 0xff;
+    b[l->crankRevs + 3] = (lastCrankEventTime >> 8) & 0xff;
+    const int16_t forceMax = (int16_t)constrain(p->forceMax, INT16_MIN, INT16_MAX);  // N
+    const int16_t forceMin = (int16_t)constrain(p->forceMin, INT16_MIN, INT16_MAX);
+    b[l->extremeForce] = forceMax & 0xff;
+    b[l->extremeForce + 1] = (forceMax >> 8) & 0xff;
+    b[l->extremeForce + 2] = forceMin & 0xff;
+    b[l->extremeForce + 3] = (forceMin >> 8) & 0xff;
+    const uint16_t maxAngle = p->forceMaxAngle < 0 ? 0 : p->forceMaxAngle;  // 12 bits each
+    const uint16_t minAngle = p->forceMinAngle < 0 ? 0 : p->forceMinAngle;
+    b[l->extremeAngles] = maxAngle & 0xff;
+    b[l->extremeAngles + 1] = ((maxAngle >> 8) & 0x0f) | ((minAngle & 0x0f) << 4);
+    b[l->extremeAngles + 2] = (minAngle >> 4) & 0xff;
+    const uint16_t top = p->topDeadSpot < 0 ? 0 : p->topDeadSpot;
+    const uint16_t bottom = p->bottomDeadSpot < 0 ? 0 : p->bottomDeadSpot;
+    b[l->deadSpots] = top & 0xff;
+    b[l->deadSpots + 1] = (top >> 8) & 0xff;
+    b[l->deadSpots + 2] = bottom & 0xff;
+    b[l->deadSpots + 3] = (bottom >> 8) & 0xff;
+    return l->length;
+}
+
+// Returns the enabled optional CPM fields that can be measured, the angles
+// need the crank angle from the gyro.
+uint8_t BleServer::_cpmEffectiveFields() {
+    uint8_t fields = cpmFields & CPM_FIELDS_ALL;
+    const uint8_t mdm = board.motionDetectionMethod;
+    if (MDM_MPU_GYRO != mdm && MDM_FUSED != mdm) fields &= ~CPM_FIELDS_ANGLES;
+    return fields;
+}
+
+// Computes the CPM field offsets, called when the CPS is started.
+void BleServer::_setupCpmLayouts() {
+    const uint8_t enabled = _cpmEffectiveFields();
+    board.power.trackAngles = enabled & CPM_FIELDS_ANGLES;
+    for (uint8_t i = 0; i < 4; i++) {
+        const uint8_t withBalance = i & 1;
+        const uint8_t fields = i & 2 ? 0 : enabled;
+        CpmLayout *l = &_cpmLayouts[withBalance][i >> 1];
+        const uint8_t scratch = CPM_LENGTH_MAX;
+        uint8_t len = 4;  // flags, power
+        l->flags = cadenceInCpm ? powerFlagsWithCadence : powerFlags;
+        l->balance = scratch;
+        if (withBalance) {
+            l->flags |= powerFlagsBalance;
+            l->balance = len;
+            len += 1;
+        }
+        l->accTorque = scratch;
+        if (fields & CPM_FIELD_ACC_TORQUE) {
+            l->flags |= powerFlagsAccTorque;
+            l->accTorque = len;
+            len += 2;
+        }
+        l->crankRevs = scratch;
+        if (cadenceInCpm) {
+            l->crankRevs = len;
+            len += 4;
+        }
+        l->extremeForce = scratch;
+        if (fields & CPM_FIELD_EXTREME_FORCE) {
+            l->flags |= powerFlagsExtremeForce;
+            l->extremeForce = len;
+            len += 4;
+        }
+        l->extremeAngles = scratch;
+        if (fields & CPM_FIELD_EXTREME_ANGLES) {
+            l->flags |= powerFlagsExtremeAngles;
+            l->extremeAngles = len;
+            len += 3;
+        }
+        l->deadSpots = scratch;
+        if (fields & CPM_FIELD_DEAD_SPOTS) {
+            l->flags |= powerFlagsDeadSpots;
+            l->deadSpots = len;
+            len += 4;
+        }
+        l->length = len;
+    }
 }
 
 // notify Cycling Speed and Cadence service
 void BleServer::notifyCsc(const ulong t) {
-    cadenceNotificationReady = false;
     if (!enabled) {
+        cadenceNotificationReady = false;
         log_i("Not enabled, not notifying SCS");
         return;
     }
-    if (!cscServiceActive) return;
-    if (cscmChar == nullptr) return;
-    if (t - CRANK_EVENT_MIN_MS < lastCadenceNotification) return;
+    if (cscmChar == nullptr || !hasSubscribers(BLE_SUB_CSCM)) {
+        cadenceNotificationReady = false;
+        return;
+    }
+    if (t - CRANK_EVENT_MIN_MS < lastCadenceNotification) return;  // stays ready, sent when due
+    cadenceNotificationReady = false;
     lastCadenceNotification = t;
+    if (!gates[BLE_GATE_CSCM].pass(crankRevs, t)) return;
     bufCadence[0] = cadenceFlags & 0xff;
     bufCadence[1] = crankRevs & 0xff;
     bufCadence[2] = (crankRevs >> 8) & 0xff;
     bufCadence[3] = lastCrankEventTime & 0xff;
     bufCadence[4] = (lastCrankEventTime >> 8) & 0xff;
-    cscmChar->setValue((uint8_t *)&bufCadence, 5);
     // log_i("Notifying cadence #%d ts %d", crankRevs, t);
-    cscmChar->notify();
+    _notify(cscmChar, BLE_SUB_CSCM, bufCadence, 5);
 }
 
 // Notify Battery Level service
@@ -303,29 +517,88 @@ void BleServer::notifyCsc(const ulong t) {
 // Set Weight Measurement char value
 void BleServer::setWmValue(float value) {
     if (!enabled) return;
-    if (lastWmValue == value) return;
-    lastWmValue = value;
+    if (!hasSubscribers(BLE_SUB_WM)) return;
+    if (!gates[BLE_GATE_WM].pass(value, millis())) return;
     uint8_t flags;
     flags = (uint8_t)0;  // Measurement Units: SI; no additional fields present
     uint16_t measurement;
     // (value/5*1000) https://github.com/oesmith/gatt-xml/blob/master/org.bluetooth.characteristic.weight_measurement.xml
     measurement = (uint16_t)(value * 200);
-    uint8_t bytes[3];
-    bytes[0] = flags;
-    bytes[1] = measurement & 0xff;
-    bytes[2] = (measurement >> 8) & 0xff;
-    wmChar->setValue((uint8_t *)bytes, 3);
-    wmChar->notify();
+    bufWm[0] = flags;
+    bufWm[1] = measurement & 0xff;
+    bufWm[2] = (measurement >> 8) & 0xff;
+    _notify(wmChar, BLE_SUB_WM, bufWm, 3);
 }
 
 // Set Hall Effect Sensor Measurement char value
 void BleServer::setHallValue(int value) {
     if (!enabled) return;
-    uint8_t bytes[2];
-    bytes[0] = value & 0xff;
-    bytes[1] = (value >> 8) & 0xff;
-    hallChar->setValue((uint8_t *)bytes, 2);
-    hallChar->notify();
+    if (!hasSubscribers(BLE_SUB_HALL)) return;
+    if (!gates[BLE_GATE_HALL].pass(value, millis())) return;
+    bufHall[0] = value & 0xff;
+    bufHall[1] = (value >> 8) & 0xff;
+    _notify(hallChar, BLE_SUB_HALL, bufHall, 2);
+}
+
+// Set Pedal Metrics char value
+// [torque effectiveness: 1][pedal smoothness: 1], both in 1/2 %
+void BleServer::setPmValue(float torqueEffectiveness, float pedalSmoothness) {
+    if (!enabled) return;
+    if (pmChar == nullptr) return;
+    if (!hasSubscribers(BLE_SUB_PM)) return;
+    const uint8_t ps = (uint8_t)constrain(pedalSmoothness * 2, 0, 200);
+    if (!gates[BLE_GATE_PM].pass(torqueEffectiveness, millis(), ps != bufPm[1])) return;
+    bufPm[0] = (uint8_t)constrain(torqueEffectiveness * 2, 0, 200);
+    bufPm[1] = ps;
+    _notify(pmChar, BLE_SUB_PM, bufPm, 2);
+}
+
+// Adds the latest sample of each strain channel to the strain stream, called
+// from the strain task on every sample of the right channel.
+void BleServer::onStrainSample(const ulong t) {
+    if (STRAIN_STREAM_OFF == strainStreamMode || nullptr == ssChar) return;
+    if (!hasSubscribers(BLE_SUB_SS)) {
+        strainStream.reset();
+        return;
+    }
+    float values[STRAIN_STREAM_CHANNELS];
+    uint8_t channels = board.strain.numChannels();
+    if (STRAIN_STREAM_CHANNELS < channels) channels = STRAIN_STREAM_CHANNELS;
+    for (uint8_t i = 0; i < channels; i++) values[i] = board.strain.liveValue(i);
+    float angle = -1.0f;
+#ifdef FEATURE_MPU
+    if (STRAIN_STREAM_ANGLE == strainStreamMode && board.mdmUsesMpu())
+        angle = board.motion.crankAngle(t);
+#endif
+    if (_streamSizeTime + 1000 < t || 0 == _streamSizeTime) {
+        _streamSize = notificationSize();
+        _streamSizeTime = t;
+    }
+    if (strainStream.push(values, channels, STRAIN_STREAM_ANGLE == strainStreamMode,
+                          angle, t, _streamSize) &&
+        nullptr != _senderTask)
+        xTaskNotifyGive(_senderTask);
+}
+
+// Sends the pending strain stream packet, called from the sender task.
+void BleServer::notifyStrainStream() {
+    uint16_t len;
+    const uint8_t *packet = strainStream.packet(&len);
+    if (enabled && nullptr != ssChar && 0 < len)
+        _notify(ssChar, BLE_SUB_SS, packet, len);
+    strainStream.release();
+}
+
+// Returns the largest notification payload all connected clients can receive.
+uint16_t BleServer::notificationSize() {
+    uint16_t mtu = BLE_ATT_MTU_MAX;
+    BLEServer *server = BLEDevice::getServer();
+    if (nullptr == server) return 20;
+    for (uint16_t connHandle : server->getPeerDevices()) {
+        uint16_t peerMtu = server->getPeerMTU(connHandle);
+        if (0 < peerMtu && peerMtu < mtu) mtu = peerMtu;
+    }
+    return mtu - 3;  // ATT header
 }
 
 const char *BleServer::characteristicStr(BLECharacteristic *c) {
@@ -334,6 +607,9 @@ const char *BleServer::characteristicStr(BLECharacteristic *c) {
     if (cscmChar != nullptr && cscmChar->getHandle() == c->getHandle()) return "CSCM";
     if (wmChar != nullptr && wmChar->getHandle() == c->getHandle()) return "WM";
     if (hallChar != nullptr && hallChar->getHandle() == c->getHandle()) return "HALL";
+    if (pmChar != nullptr && pmChar->getHandle() == c->getHandle()) return "PM";
+    if (ssChar != nullptr && ssChar->getHandle() == c->getHandle()) return "SS";
+    if (baChar != nullptr && baChar->getHandle() == c->getHandle()) return "BA";
     return c->getUUID().toString().c_str();
 }
 
@@ -341,8 +617,31 @@ void BleServer::setCadenceInCpm(bool state) {
     if (state == cadenceInCpm) return;
     cadenceInCpm = state;
     saveSettings();
-    stopCpService();
-    startCpService();
+    updateCpFormat();
+}
+
+// Sets the optional CPM fields, CPM_FIELD_* bits.
+void BleServer::setCpmFields(uint8_t fields) {
+    fields &= CPM_FIELDS_ALL;
+    if (fields == cpmFields) return;
+    cpmFields = fields;
+    saveSettings();
+    updateCpFormat();
+}
+
+// Sets the deadband and the heartbeat of a notification gate.
+bool BleServer::setGate(uint8_t gate, float deadband, ulong heartbeatMs) {
+    if (BLE_GATES <= gate || deadband < 0.0f) return false;
+    gates[gate].deadband = deadband;
+    gates[gate].heartbeatMs = heartbeatMs;
+    gates[gate].reset();
+    saveSettings();
+    return true;
+}
+
+const char *BleServer::gateStr(uint8_t gate) {
+    static const char *names[BLE_GATES] = {"cpm", "cscm", "wm", "hall", "pm"};
+    return gate < BLE_GATES ? names[gate] : "unknown";
 }
 
 void BleServer::setCscServiceActive(bool state) {
@@ -350,9 +649,9 @@ void BleServer::setCscServiceActive(bool state) {
     cscServiceActive = state;
     saveSettings();
     if (cscServiceActive)
-        startCscService();
+        advertiseService(cscsUUID);
     else
-        stopCscService();
+        unAdvertiseService(cscsUUID);
 }
 
 // Set the operating mode of the Weight Measurement char
@@ -365,10 +664,31 @@ void BleServer::setHallCharUpdateEnabled(bool state) {
     hallCharUpdateEnabled = state;
 }
 
+// Set the "update enabled" flag on the Pedal Metrics char
+void BleServer::setPmCharUpdateEnabled(bool state) {
+    pmCharUpdateEnabled = state;
+}
+
+// Set the operating mode of the strain stream char
+void BleServer::setStrainStreamMode(uint8_t mode) {
+    if (STRAIN_STREAM_MAX <= mode) return;
+    if (mode == strainStreamMode) return;
+    strainStreamMode = mode;
+    strainStream.reset();
+}
+
 void BleServer::loadSettings() {
     if (!preferencesStartLoad()) return;
     cadenceInCpm = preferences->getBool("cadenceInCpm", cadenceInCpm);
     cscServiceActive = preferences->getBool("cscService", cscServiceActive);
+    cpmFields = preferences->getUChar("cpmFields", cpmFields) & CPM_FIELDS_ALL;
+    char key[16];
+    for (uint8_t i = 0; i < BLE_GATES; i++) {
+        snprintf(key, sizeof(key), "%sDb", gateStr(i));
+        gates[i].deadband = preferences->getFloat(key, gates[i].deadband);
+        snprintf(key, sizeof(key), "%sHb", gateStr(i));
+        gates[i].heartbeatMs = preferences->getULong(key, gates[i].heartbeatMs);
+    }
     preferencesEnd();
 }
 
@@ -376,12 +696,46 @@ void BleServer::saveSettings() {
     if (!preferencesStartSave()) return;
     preferences->putBool("cadenceInCpm", cadenceInCpm);
     preferences->putBool("cscService", cscServiceActive);
+    preferences->putUChar("cpmFields", cpmFields);
+    char key[16];
+    for (uint8_t i = 0; i < BLE_GATES; i++) {
+        snprintf(key, sizeof(key), "%sDb", gateStr(i));
+        preferences->putFloat(key, gates[i].deadband);
+        snprintf(key, sizeof(key), "%sHb", gateStr(i));
+        preferences->putULong(key, gates[i].heartbeatMs);
+    }
     preferencesEnd();
 }
 
 void BleServer::printSettings() {
     log_i("Cadence data in CPM: %s", cadenceInCpm ? "Yes" : "No");
-    log_i("CSC service: %s", cscServiceActive ? "Active" : "Not active");
+    log_i("CSC service: %s", cscServiceActive ? "Advertised" : "Not advertised");
+    log_i("Optional CPM fields: 0x%02x", cpmFields);
+}
+
+bool BleServer::isConnected() {
+    BLEServer *server = BLEDevice::getServer();
+    return nullptr != server && 0 < server->getConnectedCount();
+}
+
+bool BleServer::isAdvertising() {
+    BLEAdvertising *advertising = BLEDevice::getAdvertising();
+    return nullptr != advertising && advertising->isAdvertising();
+}
+
+// Stops advertising until resumeAdvertising(), e.g. so the cores can light
+// sleep in the idle mode. Connections are kept.
+void BleServer::pauseAdvertising() {
+    if (!isAdvertising()) return;
+    BLEDevice::getAdvertising()->stop();
+    _advertisingPaused = true;
+}
+
+// Restarts advertising if it was stopped by pauseAdvertising().
+void BleServer::resumeAdvertising() {
+    if (!_advertisingPaused) return;
+    _advertisingPaused = false;
+    if (!isAdvertising()) BLEDevice::getAdvertising()->start();
 }
 
 void BleServer::onConnect(BLEServer *pServer, BLEConnInfo &info) {
@@ -393,4 +747,276 @@ void BleServer::onConnect(BLEServer *pServer, BLEConnInfo &info) {
     //     }
     // }
     Atoll::BleServer::onConnect(pServer, info);
-}
\ No newline at end of file
+    Connection *conn = connection(info.getConnHandle(), true);
+    if (nullptr == conn) return;
+    conn->profileTime = millis();
+    _storeConnParams(info);
+}
+
+void BleServer::onDisconnect(BLEServer *pServer, BLEConnInfo &info, int reason) {
+    Connection *conn = connection(info.getConnHandle());
+    if (nullptr != conn) *conn = Connection();
+    Atoll::BleServer::onDisconnect(pServer, info, reason);
+}
+
+// Keeps track of the subscriptions of each connection, notifications are only
+// sent to subscribed connections.
+void BleServer::onSubscribe(BLECharacteristic *c, BLEConnInfo &info, uint16_t subValue) {
+    Atoll::BleServer::onSubscribe(c, info, subValue);
+    const uint8_t sub = subscriptionBit(c);
+    if (0 == sub) return;
+    Connection *conn = connection(info.getConnHandle(), true);
+    if (nullptr == conn) {
+        log_e("no free slot for connection %d", info.getConnHandle());
+        return;
+    }
+    if (subValue & 1)
+        conn->notify |= sub;
+    else
+        conn->notify &= ~sub;
+    if (subValue & 2)
+        conn->indicate |= sub;
+    else
+        conn->indicate &= ~sub;
+}
+
+// Copies the encoded value into the characteristic before it is read.
+void BleServer::onRead(BLECharacteristic *c, BLEConnInfo &info) {
+    switch (subscriptionBit(c)) {
+        case BLE_SUB_CPM:
+            if (0 < bufPowerLength) c->setValue(bufPower, bufPowerLength);
+            break;
+        case BLE_SUB_CSCM:
+            c->setValue(bufCadence, sizeof(bufCadence));
+            break;
+        case BLE_SUB_WM:
+            c->setValue(bufWm, sizeof(bufWm));
+            break;
+        case BLE_SUB_HALL:
+            c->setValue(bufHall, sizeof(bufHall));
+            break;
+        case BLE_SUB_PM:
+            c->setValue(bufPm, sizeof(bufPm));
+            break;
+    }
+    Atoll::BleServer::onRead(c, info);
+}
+
+// Queues control point requests, they are processed in the request task so
+// the BLE host task is not blocked by taring or writing preferences.
+void BleServer::onWrite(BLECharacteristic *c, BLEConnInfo &info) {
+    if (nullptr != baChar && nullptr != c && c->getHandle() == baChar->getHandle()) {
+        const NimBLEAttValue value = c->getValue();
+        if (binaryApi.onWrite(info.getConnHandle(), value.data(), value.size()) &&
+            nullptr != _requestTask)
+            xTaskNotifyGive(_requestTask);
+        return;
+    }
+    if (nullptr == cpcChar || nullptr == c || c->getHandle() != cpcChar->getHandle()) {
+        Atoll::BleServer::onWrite(c, info);
+        return;
+    }
+    // The response can only be indicated: the spec answers a write from a
+    // client without indications with ATT error 0xFD (CCCD improperly
+    // configured). The write callback can not return an ATT error, so the
+    // request is ignored instead of being executed without a response.
+    Connection *conn = connection(info.getConnHandle());
+    if (nullptr == conn || !(conn->indicate & BLE_SUB_CPC)) {
+        log_e("control point request ignored, indications not enabled by %d", info.getConnHandle());
+        return;
+    }
+    const NimBLEAttValue value = c->getValue();
+    if (nullptr == _cpcQueue || 0 == value.size() || CPCP_REQUEST_MAX < value.size()) {
+        log_e("control point request dropped, size %d", value.size());
+        return;
+    }
+    ControlPointRequest request;
+    request.connHandle = info.getConnHandle();
+    request.len = value.size();
+    memcpy(request.data, value.data(), request.len);
+    if (pdTRUE != xQueueSend(_cpcQueue, &request, 0)) {
+        log_e("control point queue full");
+        return;
+    }
+    if (nullptr != _requestTask) xTaskNotifyGive(_requestTask);
+}
+
+// Executes a binary api request and notifies the response in frames
+// to the connection that sent it, see binary_api.h
+void BleServer::_processBinaryApi() {
+    const uint16_t connHandle = binaryApi.process();
+    const uint16_t size = notificationSize();
+    uint16_t len;
+    const uint8_t *frame;
+    while (nullptr != (frame = binaryApi.frame(size, &len))) {
+        if (!_notifyPaced(baChar, frame, len, connHandle)) {
+            log_e("could not send binary api response");
+            frame = binaryApi.failed(&len);
+            _notifyPaced(baChar, frame, len, connHandle);
+            return;
+        }
+    }
+}
+
+// Notifies the connection, waiting for the host to free its buffers when a
+// burst of notifications used them up. Returns false if the value could not
+// be sent, or the connection is gone.
+bool BleServer::_notifyPaced(BLECharacteristic *c, const uint8_t *data, uint16_t len, uint16_t connHandle) {
+    if (nullptr == c) return false;
+    for (uint8_t i = 0; i < BLE_NOTIFY_RETRIES; i++) {
+        if (c->notify(data, len, connHandle)) return true;
+        if (nullptr == connection(connHandle)) return false;
+        vTaskDelay(pdMS_TO_TICKS(BLE_NOTIFY_RETRY_MS));
+    }
+    return false;
+}
+
+// Executes a control point request and indicates the response to the
+// connection that sent it: [response op code][request op code][result][parameter]
+void BleServer::_processControlPoint(const ControlPointRequest *request) {
+    const uint8_t *d = request->data;
+    uint8_t response[6] = {CPCP_RESPONSE, d[0], CPCP_SUCCESS};
+    uint8_t len = 3;
+    switch (d[0]) {
+        case CPCP_SET_CRANK_LENGTH: {
+            if (request->len < 3) {
+                response[2] = CPCP_INVALID_PARAMETER;
+                break;
+            }
+            float crankLength = (d[1] | (d[2] << 8)) / 2.0f;  // 1/2 mm
+            if (crankLength <= 10 || 2000 <= crankLength) {
+                response[2] = CPCP_INVALID_PARAMETER;
+                break;
+            }
+            board.power.crankLength = crankLength;
+            board.power.saveSettings();
+            break;
+        }
+        case CPCP_REQUEST_CRANK_LENGTH: {
+            uint16_t crankLength = (uint16_t)lroundf(board.power.crankLength * 2);
+            response[len++] = crankLength & 0xff;
+            response[len++] = (crankLength >> 8) & 0xff;
+            break;
+        }
+        case CPCP_START_OFFSET_COMPENSATION: {
+            // the offset is the force in N before taring
+            int16_t offset = (int16_t)constrain(lroundf(board.strain.liveValue() * 9.80665f),
+                                                INT16_MIN + 1, INT16_MAX);
+            board.strain.tare();
+            response[len++] = offset & 0xff;
+            response[len++] = (offset >> 8) & 0xff;
+            break;
+        }
+        case CPCP_REQUEST_SAMPLING_RATE:
+            response[len++] = (uint8_t)lroundf(board.strain.sps);
+            break;
+        case CPCP_SET_CUMULATIVE_VALUE:  // the value is wheel revolutions, there is no wheel data
+        default:
+            response[2] = CPCP_NOT_SUPPORTED;
+    }
+    log_i("control point op 0x%02x result %d", d[0], response[2]);
+    if (nullptr != cpcChar) cpcChar->indicate(response, len, request->connHandle);
+}
+
+void BleServer::onConnParamsUpdate(BLEConnInfo &info) {
+    Atoll::BleServer::onConnParamsUpdate(info);
+    _storeConnParams(info);
+}
+
+void BleServer::_storeConnParams(BLEConnInfo &info) {
+    Connection *conn = connection(info.getConnHandle());
+    if (nullptr == conn) return;
+    conn->interval = info.getConnInterval();
+    conn->latency = info.getConnLatency();
+    conn->timeout = info.getConnTimeout();
+    log_d("conn %d interval %.2fms latency %d timeout %dms",
+          conn->handle, conn->interval * 1.25f, conn->latency, conn->timeout * 10);
+}
+
+// Returns the connection parameter profile for the riding state: idle while
+// the crank is not moving, low latency while the strain stream is subscribed.
+uint8_t BleServer::connProfile(const ulong t) {
+    if (BLE_CONN_AUTO != connProfileMode) return connProfileMode;
+    if (board.idle || board.motion.lastMovement + BLE_CONN_IDLE_MS < t) return BLE_CONN_IDLE;
+    if (STRAIN_STREAM_OFF != strainStreamMode && hasSubscribers(BLE_SUB_SS)) return BLE_CONN_STREAM;
+    return BLE_CONN_RIDE;
+}
+
+void BleServer::setConnProfileMode(uint8_t mode) {
+    if (BLE_CONN_AUTO != mode && BLE_CONN_PROFILES <= mode) return;
+    connProfileMode = mode;
+}
+
+// Requests the connection parameters of the current profile from each
+// central whose connection uses a different one. The central decides, the
+// parameters in effect are stored by onConnParamsUpdate().
+void BleServer::_updateConnParams(const ulong t) {
+    BLEServer *server = BLEDevice::getServer();
+    if (nullptr == server) return;
+    const uint8_t profile = connProfile(t);
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++) {
+        Connection *conn = &connections[i];
+        if (BLE_HS_CONN_HANDLE_NONE == conn->handle) continue;
+        if (profile == conn->profile) continue;
+        if (t - conn->profileTime < BLE_CONN_UPDATE_MIN_MS) continue;
+        log_d("conn %d profile %d", conn->handle, profile);
+        server->updateConnParams(conn->handle,
+                                 bleConnProfiles[profile].minInterval,
+                                 bleConnProfiles[profile].maxInterval,
+                                 bleConnProfiles[profile].latency,
+                                 bleConnProfiles[profile].timeout);
+        conn->profile = profile;
+        conn->profileTime = t;
+    }
+}
+
+// Returns the table entry of the connection, with add a free
+// entry is assigned if not found. Returns nullptr if not found.
+BleServer::Connection *BleServer::connection(uint16_t handle, bool add) {
+    Connection *free = nullptr;
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++) {
+        if (handle == connections[i].handle) return &connections[i];
+        if (nullptr == free && BLE_HS_CONN_HANDLE_NONE == connections[i].handle)
+            free = &connections[i];
+    }
+    if (!add || nullptr == free) return nullptr;
+    *free = Connection();
+    free->handle = handle;
+    return free;
+}
+
+// Returns the BLE_SUB_* bit of the characteristic, 0 if not tracked.
+uint8_t BleServer::subscriptionBit(BLECharacteristic *c) {
+    if (nullptr == c) return 0;
+    const uint16_t h = c->getHandle();
+    if (nullptr != cpmChar && cpmChar->getHandle() == h) return BLE_SUB_CPM;
+    if (nullptr != cscmChar && cscmChar->getHandle() == h) return BLE_SUB_CSCM;
+    if (nullptr != wmChar && wmChar->getHandle() == h) return BLE_SUB_WM;
+    if (nullptr != hallChar && hallChar->getHandle() == h) return BLE_SUB_HALL;
+    if (nullptr != pmChar && pmChar->getHandle() == h) return BLE_SUB_PM;
+    if (nullptr != ssChar && ssChar->getHandle() == h) return BLE_SUB_SS;
+    if (nullptr != cpcChar && cpcChar->getHandle() == h) return BLE_SUB_CPC;
+    return 0;
+}
+
+bool BleServer::hasSubscribers(uint8_t sub) {
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++)
+        if (BLE_HS_CONN_HANDLE_NONE != connections[i].handle &&
+            ((connections[i].notify | connections[i].indicate) & sub))
+            return true;
+    return false;
+}
+
+// Sends the encoded value to each subscribed connection. The value is encoded
+// once per update, connections that are not subscribed are skipped.
+void BleServer::_notify(BLECharacteristic *c, uint8_t sub, const uint8_t *data, uint16_t len) {
+    if (nullptr == c) return;
+    for (uint8_t i = 0; i < BLE_SERVER_MAX_CONNECTIONS; i++) {
+        const Connection *conn = &connections[i];
+        if (BLE_HS_CONN_HANDLE_NONE == conn->handle) continue;
+        if (conn->notify & sub)
+            c->notify(data, len, conn->handle);
+        else if (conn->indicate & sub)
+            c->indicate(data, len, conn->handle);
+    }
+}
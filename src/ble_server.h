@@ -4,11 +4,70 @@
 #include "definitions.h"
 #include "atoll_ble_server.h"
 #include "atoll_preferences.h"
+#include "strain_stream.h"
+#include "notify_gate.h"
+#include "binary_api.h"
 
 #ifndef BLE_CHAR_VALUE_MAXLENGTH
 #define BLE_CHAR_VALUE_MAXLENGTH 128
 #endif
 
+#ifndef BLE_SERVER_MAX_CONNECTIONS
+#ifdef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define BLE_SERVER_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#else
+#define BLE_SERVER_MAX_CONNECTIONS 3
+#endif
+#endif
+
+// cycling power control point op codes and response values
+#define CPCP_SET_CUMULATIVE_VALUE 0x01
+#define CPCP_SET_CRANK_LENGTH 0x04
+#define CPCP_REQUEST_CRANK_LENGTH 0x05
+#define CPCP_START_OFFSET_COMPENSATION 0x0c
+#define CPCP_REQUEST_SAMPLING_RATE 0x0e
+#define CPCP_RESPONSE 0x20
+#define CPCP_SUCCESS 0x01
+#define CPCP_NOT_SUPPORTED 0x02
+#define CPCP_INVALID_PARAMETER 0x03
+#define CPCP_FAILED 0x04
+#define CPCP_QUEUE_LENGTH 4     // pending control point requests
+#define CPCP_REQUEST_MAX 8      // maximum length of a control point request
+
+// notification gates
+#define BLE_GATE_CPM 0   // power in W, crank events always pass
+#define BLE_GATE_CSCM 1  // crank revolutions
+#define BLE_GATE_WM 2    // weight in kg
+#define BLE_GATE_HALL 3  // hall reading
+#define BLE_GATE_PM 4    // torque effectiveness in %, a pedal smoothness change always passes
+#define BLE_GATES 5      // number of gates
+
+// optional cycling power measurement fields
+#define CPM_FIELD_ACC_TORQUE (1 << 0)      // accumulated torque
+#define CPM_FIELD_EXTREME_FORCE (1 << 1)   // extreme force magnitudes
+#define CPM_FIELD_EXTREME_ANGLES (1 << 2)  // crank angles of the extreme magnitudes, needs the gyro crank angle
+#define CPM_FIELD_DEAD_SPOTS (1 << 3)      // top and bottom dead spot angles, needs the gyro crank angle
+#define CPM_FIELDS_ANGLES (CPM_FIELD_EXTREME_ANGLES | CPM_FIELD_DEAD_SPOTS)
+#define CPM_FIELDS_ALL 0x0f
+#define CPM_LENGTH_MAX 22  // all fields present, more than the 20 byte payload of the default MTU
+#define CPM_SCRATCH 4      // size of the largest field, fields not present are written here
+
+#define BLE_CONN_IDLE 0      // connection parameter profile: relaxed interval with slave latency
+#define BLE_CONN_RIDE 1      // pedalling
+#define BLE_CONN_STREAM 2    // pedalling with the strain stream subscribed
+#define BLE_CONN_PROFILES 3  // number of connection parameter profiles
+#define BLE_CONN_AUTO 0xff   // profile selected from the riding state
+#define BLE_CONN_NONE 0xff   // no profile requested yet
+
+// characteristic bits of the subscription table
+#define BLE_SUB_CPM (1 << 0)   // cycling power measurement
+#define BLE_SUB_CSCM (1 << 1)  // cycling speed and cadence measurement
+#define BLE_SUB_WM (1 << 2)    // weight measurement
+#define BLE_SUB_HALL (1 << 3)  // hall effect sensor measurement
+#define BLE_SUB_PM (1 << 4)    // pedal metrics
+#define BLE_SUB_SS (1 << 5)    // strain stream
+#define BLE_SUB_CPC (1 << 6)   // cycling power control point, indications only
+
 class BleServer : public Atoll::BleServer,
                   public Atoll::Preferences {
    public:
@@ -17,20 +76,26 @@ class BleServer : public Atoll::BleServer,
     // BLECharacteristic *diChar;    // device information characteristic
     BLEUUID cpsUUID;              // cycling power service uuid
     BLEService *cps;              // cycling power service
-    BLECharacteristic *cpmChar;   // cycling power measurement characteristic
+    BLECharacteristic *cpfChar = nullptr;   // cycling power feature characteristic
+    BLECharacteristic *cpmChar = nullptr;   // cycling power measurement characteristic
+    BLEDescriptor *cpmDesc = nullptr;       // cycling power measurement description
+    BLECharacteristic *cpcChar = nullptr;   // cycling power control point characteristic
     BLEUUID cscsUUID;             // cycling speed and cadence service uuid
     BLEService *cscs;             // cycling speed and cadence service
-    BLECharacteristic *cscmChar;  // cycling speed and cadence measurement characteristic
+    BLECharacteristic *cscmChar = nullptr;  // cycling speed and cadence measurement characteristic
     // BLEUUID blsUUID;              // battery level service uuid
     // BLEService *bls;              // battery level service
     // BLECharacteristic *blChar;    // battery level characteristic
     BLEUUID wssUUID;            // weight scale service uuid
     BLEService *wss;            // weight scale service
-    BLECharacteristic *wmChar;  // weight measurement characteristic
+    BLECharacteristic *wmChar = nullptr;  // weight measurement characteristic
     // BLEUUID asUUID;               // api service uuid
     // BLEService *as;               // api service
     // BLECharacteristic *apiChar;   // api characteristic
-    BLECharacteristic *hallChar;  // hall effect sensor measurement characteristic
+    BLECharacteristic *hallChar = nullptr;  // hall effect sensor measurement characteristic
+    BLECharacteristic *pmChar = nullptr;  // pedal metrics characteristic
+    BLECharacteristic *ssChar = nullptr;  // strain stream characteristic
+    BLECharacteristic *baChar = nullptr;  // binary api characteristic
     // BLEAdvertising *advertising;  // pointer to advertising
 
     bool powerNotificationReady = false;
@@ -41,22 +106,57 @@ class BleServer : public Atoll::BleServer,
     // unsigned long lastBatteryNotification = 0;
     uint8_t wmCharMode = WM_CHAR_MODE;   // weight measurement char updates and notifications
     bool hallCharUpdateEnabled = false;  // enables hall measurement value updates and notifications
+    bool pmCharUpdateEnabled = false;    // enables pedal metrics value updates and notifications
+    bool pmNotificationReady = false;
+    uint8_t strainStreamMode = STRAIN_STREAM_OFF;  // strain stream char updates and notifications
+    StrainStream strainStream;
+    BinaryApi binaryApi;
     unsigned long lastWmNotification = 0;
-    float lastWmValue = 0.0;
     unsigned long lastHallNotification = 0;
 
     bool cadenceInCpm = true;       // whether to include cadence data in CPM
-    bool cscServiceActive = false;  // whether CSC service should be active
+    uint8_t cpmFields = 0;          // optional CPM fields, CPM_FIELD_* bits
+
+    // deadband and heartbeat of each characteristic, BLE_GATE_*
+    NotifyGate gates[BLE_GATES] = {
+        NotifyGate(0.0f, BLE_GATE_CPM_HEARTBEAT_MS),
+        NotifyGate(0.0f, BLE_GATE_CSCM_HEARTBEAT_MS),
+        NotifyGate(BLE_GATE_WM_DEADBAND, BLE_GATE_WM_HEARTBEAT_MS),
+        NotifyGate(0.0f, BLE_GATE_HALL_HEARTBEAT_MS),
+        NotifyGate(0.0f, 0),
+    };
+    bool cscServiceActive = false;  // whether CSC service should be advertised, it is always served
 
     uint16_t power = 0;
     uint16_t crankRevs = 0;
-    uint16_t lastCrankEventTime = 0;                            // 1/1024s, rolls over
+    uint16_t lastCrankEventTime = 0;                            // 1/1024s, rolls over, see Timebase
     const uint16_t powerFlags = 0b0000000000000000;             // Only instantaneous power present
     const uint16_t powerFlagsWithCadence = 0b0000000000100000;  // Crank rev data present
+    const uint16_t powerFlagsBalance = 0b0000000000000011;      // Pedal power balance present, reference: left
+    const uint16_t powerFlagsAccTorque = 0b0000000000001100;    // Accumulated torque present, source: crank
+    const uint16_t powerFlagsExtremeForce = 0b0000000001000000; // Extreme force magnitudes present
+    const uint16_t powerFlagsExtremeAngles = 0b0000000100000000; // Extreme angles present
+    const uint16_t powerFlagsDeadSpots = 0b0000011000000000;    // Top and bottom dead spot angles present
     const uint8_t cadenceFlags = 0b00000010;                    // Wheel rev data present = 0, Crank rev data present = 1
+    const uint32_t featureBalance = 1 << 0;                     // Pedal power balance supported
+    const uint32_t featureAccTorque = 1 << 1;                   // Accumulated torque supported
+    const uint32_t featureCrankRevs = 1 << 3;                   // Crank revolution data supported
+    const uint32_t featureExtremeMagnitudes = 1 << 4;           // Extreme magnitudes supported
+    const uint32_t featureExtremeAngles = 1 << 5;               // Extreme angles supported
+    const uint32_t featureDeadSpots = 1 << 6;                   // Top and bottom dead spot angles supported
+    const uint32_t featureOffsetCompensation = 1 << 9;          // Offset compensation supported
+    const uint32_t featureCrankLength = 1 << 12;                // Crank length adjustment supported
 
-    unsigned char bufPower[8];    // [flags: 2][power: 2][revolutions: 2][last crank event: 2]
+    // Encoded values are sent from these buffers to every subscribed connection
+    // and copied into the characteristic only when read, see onRead().
+    // [flags: 2][power: 2][balance: 1][accumulated torque: 2][revolutions: 2][last crank event: 2]
+    // [max force: 2][min force: 2][extreme angles: 3][top dead spot: 2][bottom dead spot: 2]
+    unsigned char bufPower[CPM_LENGTH_MAX + CPM_SCRATCH];
+    uint8_t bufPowerLength = 0;
     unsigned char bufCadence[5];  // [flags: 1][revolutions: 2][last crank event: 2]
+    unsigned char bufWm[3];       // [flags: 1][weight: 2]
+    unsigned char bufHall[2];     // [value: 2]
+    unsigned char bufPm[2];       // [torque effectiveness: 1][pedal smoothness: 1]
     unsigned char bufSensorLocation[1];
     unsigned char bufControlPoint[1];
     unsigned char bufPowerFeature[4];
@@ -69,26 +169,116 @@ class BleServer : public Atoll::BleServer,
 
     void startCpService();
     void stopCpService();
+    void updateCpFormat();
     void startCscService();
     void stopCscService();
     void startWsService();
-    void onCrankEvent(const ulong t, const uint16_t revolutions);
+    void onCrankEvent(const int64_t us, const uint16_t revolutions);
     void notifyCp(const ulong t);
     void notifyCsc(const ulong t);
     // void notifyBl(const ulong t);
     void setWmValue(float value);
     void setHallValue(int value);
+    void setPmValue(float torqueEffectiveness, float pedalSmoothness);
+    void onStrainSample(const ulong t);
+    void notifyStrainStream();
+    uint16_t notificationSize();
     const char *characteristicStr(BLECharacteristic *c);
+    bool isConnected();
+    bool isAdvertising();
+    void pauseAdvertising();
+    void resumeAdvertising();
 
     void setCadenceInCpm(bool state);
+    void setCpmFields(uint8_t fields);
+    bool setGate(uint8_t gate, float deadband, ulong heartbeatMs);
+    const char *gateStr(uint8_t gate);
     void setCscServiceActive(bool state);
     void setWmCharMode(uint8_t mode);
     void setHallCharUpdateEnabled(bool state);
+    void setPmCharUpdateEnabled(bool state);
+    void setStrainStreamMode(uint8_t mode);
     void loadSettings();
     void saveSettings();
     void printSettings();
 
+    // Connection table entry
+    struct Connection {
+        uint16_t handle = BLE_HS_CONN_HANDLE_NONE;
+        uint8_t notify = 0;    // BLE_SUB_* bits
+        uint8_t indicate = 0;  // BLE_SUB_* bits
+        uint8_t profile = BLE_CONN_NONE;  // requested connection parameter profile
+        ulong profileTime = 0;            // time of connecting or of the last request
+        uint16_t interval = 0;            // current connection interval in 1.25 ms
+        uint16_t latency = 0;             // current slave latency in connection events
+        uint16_t timeout = 0;             // current supervision timeout in 10 ms
+    };
+
+    Connection connections[BLE_SERVER_MAX_CONNECTIONS];
+    uint8_t connProfileMode = BLE_CONN_AUTO;  // BLE_CONN_AUTO or a fixed profile
+
+    Connection *connection(uint16_t handle, bool add = false);
+    uint8_t subscriptionBit(BLECharacteristic *c);
+    bool hasSubscribers(uint8_t sub);
+    uint8_t connProfile(const ulong t);
+    void setConnProfileMode(uint8_t mode);
+
     virtual void onConnect(BLEServer *pServer, BLEConnInfo &connInfo) override;
+    virtual void onDisconnect(BLEServer *pServer, BLEConnInfo &connInfo, int reason) override;
+    virtual void onSubscribe(BLECharacteristic *c, BLEConnInfo &connInfo, uint16_t subValue) override;
+    virtual void onRead(BLECharacteristic *c, BLEConnInfo &connInfo) override;
+    virtual void onConnParamsUpdate(BLEConnInfo &connInfo) override;
+    virtual void onWrite(BLECharacteristic *c, BLEConnInfo &connInfo) override;
+
+   protected:
+    TaskHandle_t _senderTask = nullptr;   // sends CPM and CSCM notifications, see onCrankEvent()
+    TaskHandle_t _requestTask = nullptr;  // processes control point and binary api requests
+    uint16_t _streamSize = 20;           // strain stream packet size, see notificationSize()
+    ulong _streamSizeTime = 0;
+    bool _advertisingPaused = false;      // stopped by pauseAdvertising()
+
+    void _notify(BLECharacteristic *c, uint8_t sub, const uint8_t *data, uint16_t len);
+    // Control point requests are queued by onWrite() in the BLE host task and
+    // processed in the request task, as they may write preferences or tare.
+    struct ControlPointRequest {
+        uint16_t connHandle;
+        uint8_t len;
+        uint8_t data[CPCP_REQUEST_MAX];
+    };
+
+    QueueHandle_t _cpcQueue = nullptr;
+
+    void _processRequests();
+    void _processControlPoint(const ControlPointRequest *request);
+    void _processBinaryApi();
+    bool _notifyPaced(BLECharacteristic *c, const uint8_t *data, uint16_t len, uint16_t connHandle);
+    // Offsets of the CPM fields in bufPower, fields that are not present point
+    // to the scratch area after the packet, so notifyCp() writes all of them.
+    struct CpmLayout {
+        uint16_t flags;
+        uint8_t balance;
+        uint8_t accTorque;
+        uint8_t crankRevs;
+        uint8_t extremeForce;
+        uint8_t extremeAngles;
+        uint8_t deadSpots;
+        uint8_t length;
+    };
+
+    // [without and with balance][all enabled fields, without the optional fields]
+    // The compact layout is sent to connections whose MTU is too small for all fields.
+    CpmLayout _cpmLayouts[2][2];
+
+    uint8_t _cpmEffectiveFields();
+    void _setupCpmLayouts();
+    uint8_t _encodeCp(const CpmLayout *l, uint8_t *b);
+    void _updateConnParams(const ulong t);
+    void _storeConnParams(BLEConnInfo &info);
+    static void _senderTaskFn(void *arg);
+    void _senderLoop();
+    ulong _senderWait(const ulong t);
+    static void _requestTaskFn(void *arg);
+    void _requestLoop();
 };
 
 #endif
\ No newline at end of file
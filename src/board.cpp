@@ -1,5 +1,7 @@
 #include "board.h"
 
+#include "driver/adc.h"
+
 void Board::setup() {
     setCpuFrequencyMhz(80);  // no wifi/bt below 80MHz
 
@@ -12,185 +14,262 @@ void Board::setup() {
     Serial.setup(&hwSerial, &wifiSerial);
     while (!hwSerial) vTaskDelay(10);
 #endif
+    fastWake = rtcState.check();
     preferencesSetup(&arduinoPreferences, "BOARD");
     loadSettings();
     log_i("\n\n\n%s %s %s\n\n\n", hostName, __DATE__, __TIME__);
-    setupTask("bleServer");
-    setupTask("api");
-    setupTask("ota");
-    setupTask("led");
-    setupTask("wifi");
-    setupTask("battery");
-    setupTask("motion");
-    setupTask("strain");
-    setupTask("power");
+
+    // sensors are brought up on the other core while the BLE and WiFi stacks are set up here
+    _bootEvents = xEventGroupCreate();
+    const bool concurrent = nullptr != _bootEvents &&
+                            pdPASS == xTaskCreatePinnedToCore(_sensorSetupTask, "sensorSetup",
+                                                              BOOT_SENSOR_TASK_STACK, this, 1, nullptr,
+                                                              BOOT_SENSOR_CORE);
+    if (!concurrent) log_e("could not start sensor setup task, setting up sequentially");
+    _timedSetupTask("bleServer");
+    _timedSetupTask("api");
+    _timedSetupTask("ota");
+    _timedSetupTask("led");
+    _timedSetupTask("wifi");
+    _timedSetupTask("battery");
     // setupTask("status");
-    setupTask("temperature");
-    setupTask("tc");
+    if (concurrent) {
+        xEventGroupSetBits(_bootEvents, BOOT_API_READY);
+        xEventGroupWaitBits(_bootEvents, BOOT_SENSORS_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+    } else
+        _setupSensors(false);
+    if (fastWake) _restoreRtcState();
+    rtcState.invalidate();
 
+    int8_t stage = bootProfile.start("bleStart");
     bleServer.start();
+    bootProfile.end(stage);
+    stage = bootProfile.start("wifiStart");
     wifi.start();
+    bootProfile.end(stage);
+}
+
+// Sets up the sensor modules. Cadence and the temperature modules add API
+// commands, so with waitForApi they wait until the API is set up and no other
+// stage adds commands.
+void Board::_setupSensors(bool waitForApi) {
+    _timedSetupTask("motion");
+    _timedSetupTask("strain");  // needs motion
+    _timedSetupTask("power");
+    if (waitForApi)
+        xEventGroupWaitBits(_bootEvents, BOOT_API_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+    _timedSetupTask("cadence");
+    _timedSetupTask("temperature");
+    _timedSetupTask("tc");
+}
+
+void Board::_sensorSetupTask(void *arg) {
+    Board *b = (Board *)arg;
+    b->_setupSensors(true);
+    xEventGroupSetBits(b->_bootEvents, BOOT_SENSORS_READY);
+    vTaskDelete(NULL);
+}
+
+void Board::_timedSetupTask(const char *taskName) {
+    int8_t stage = bootProfile.start(taskName);
+    setupTask(taskName);
+    bootProfile.end(stage);
+}
+
+// Looks up a task in the registry, returns nullptr if there is no such task.
+Board::TaskEntry *Board::task(const char *taskName) {
+    for (uint8_t i = 0; i < sizeof(_tasks) / sizeof(_tasks[0]); i++)
+        if (nullptr != _tasks[i].name && strcmp(_tasks[i].name, taskName) == 0) return &_tasks[i];
+    return nullptr;
+}
+
+// Returns nullptr past the last entry, entries left empty by a short table end the list.
+Board::TaskEntry *Board::taskAt(uint8_t index) {
+    if (sizeof(_tasks) / sizeof(_tasks[0]) <= index || nullptr == _tasks[index].name) return nullptr;
+    return &_tasks[index];
 }
 
 void Board::setupTask(const char *taskName) {
-    if (strcmp("led", taskName) == 0) {
-        led.setup();
+    TaskEntry *e = task(taskName);
+    if (nullptr == e) {
+        log_e("unknown task: %s", taskName);
         return;
     }
-    if (strcmp("wifi", taskName) == 0) {
-        wifi.setup(hostName, preferences, "Wifi", &wifi, &api, &ota);
-        return;
-    }
-    if (strcmp("bleServer", taskName) == 0) {
-        bleServer.setup(hostName, preferences);
-        return;
-    }
-    if (strcmp("api", taskName) == 0) {
-        api.setup(&api, &arduinoPreferences, "API", API_SERVICE_UUID);
-        return;
-    }
-    if (strcmp("ota", taskName) == 0) {
-        ota.setup(hostName, 3232, true);
-        return;
-    }
-    if (strcmp("battery", taskName) == 0) {
-        battery.setup(preferences, BATTERY_PIN, &battery, &api, &bleServer);
-        return;
-    }
-    if (strcmp("strain", taskName) == 0) {
-        strain.setup(STRAIN_DOUT_PIN, STRAIN_SCK_PIN, preferences);
-        return;
+    (this->*e->setup)();
+}
+
+void Board::startTasks() {
+#ifdef FEATURE_SERIAL
+    // startTask("wifiSerial");
+#endif
+    for (uint8_t i = 0; nullptr != taskAt(i); i++)
+        if (_tasks[i].autoStart) startTask(_tasks[i].name);
+    taskStart(BOARD_TASK_FREQ, 4096 + 1024);
+}
+
+// Starts the task with the frequency, stack size and priority of its entry.
+// Returns false if the task is unknown or should not run in the current mode.
+bool Board::startTask(const char *taskName) {
+    TaskEntry *e = task(taskName);
+    if (nullptr == e) {
+        log_e("unknown task: %s", taskName);
+        return false;
     }
-    if (strcmp("power", taskName) == 0) {
-        power.setup(preferences);
-        return;
+    if (nullptr != e->onStart) (this->*e->onStart)();
+    if (nullptr == e->task) return true;
+    float freq = nullptr != e->freqFn ? (this->*e->freqFn)() : e->freq;
+    if (freq <= 0.0f) return false;
+    if (0 < e->stack)
+        e->task->taskStart(freq, e->stack);
+    else
+        e->task->taskStart(freq);
+    if (0 <= e->priority && nullptr != e->task->taskHandle)
+        vTaskPrioritySet(e->task->taskHandle, e->priority);
+    e->runningFreq = freq;
+    e->running = true;
+    return true;
+}
+
+bool Board::stopTask(const char *taskName) {
+    TaskEntry *e = task(taskName);
+    if (nullptr == e || nullptr == e->task) {
+        log_e("cannot stop task: %s", taskName);
+        return false;
     }
-    if (strcmp("motion", taskName) == 0) {
+    e->task->taskStop();
+    e->running = false;
+    return true;
+}
+
+void Board::restartTask(const char *taskName) {
+    log_i("restarting task %s", taskName);
+    stopTask(taskName);
+    startTask(taskName);
+}
+
+// Changes the frequency of a running task, it is kept until the task restarts.
+// Modules retune their own tasks through this as well, so runningFreq stays
+// current. Returns false if the task is not running, its start frequency is
+// then taken from the entry.
+bool Board::setTaskFreq(const char *taskName, float freq) {
+    TaskEntry *e = task(taskName);
+    if (nullptr == e || nullptr == e->task || !e->running || freq <= 0.0f) return false;
+    e->task->taskSetFreq(freq);
+    e->runningFreq = freq;
+    return true;
+}
+
+// Sets the priority, applied right away if the task is running.
+bool Board::setTaskPriority(const char *taskName, int8_t priority) {
+    TaskEntry *e = task(taskName);
+    if (nullptr == e || nullptr == e->task || priority < 0 || configMAX_PRIORITIES <= priority) return false;
+    e->priority = priority;
+    if (e->running && nullptr != e->task->taskHandle)
+        vTaskPrioritySet(e->task->taskHandle, priority);
+    return true;
+}
+
+void Board::_setupLed() {
+    led.setup();
+}
+
+void Board::_setupWifi() {
+    wifi.setup(hostName, preferences, "Wifi", &wifi, &api, &ota);
+}
+
+void Board::_setupBleServer() {
+    bleServer.setup(hostName, preferences);
+    task("bleServer")->stack = bleServer.taskStack;
+}
+
+void Board::_setupApi() {
+    api.setup(&api, &arduinoPreferences, "API", API_SERVICE_UUID);
+}
+
+void Board::_setupOta() {
+    ota.setup(hostName, 3232, true);
+}
+
+void Board::_setupBattery() {
+    battery.setup(preferences, BATTERY_PIN, &battery, &api, &bleServer);
+}
+
+void Board::_setupStrain() {
+    const gpio_num_t doutPins[] = {STRAIN_DOUT_PIN, STRAIN_LEFT_DOUT_PIN};
+    const gpio_num_t sckPins[] = {STRAIN_SCK_PIN, STRAIN_LEFT_SCK_PIN};
+    strain.setup(doutPins, sckPins, &sensorPreferences, "STRAIN", STRAIN_RATE_PIN);
+}
+
+void Board::_setupPower() {
+    power.setup(&sensorPreferences);
+}
+
+void Board::_setupCadence() {
+    cadence.setup(&sensorPreferences);
+}
+
+void Board::_setupMotion() {
 #ifdef FEATURE_MPU
-        if (motionDetectionMethod == MDM_HALL || motionDetectionMethod == MDM_MPU
+    if (mdmUsesMotionTask() || mdmUsesMpu()
 #ifdef FEATURE_MPU_TEMPERATURE
-            || true
+        || true
 #endif  // FEATURE_MPU_TEMPERATURE
-        )
-            motion.setup(MPU_SDA_PIN, MPU_SCL_PIN, preferences);
+    )
+        motion.setup(MPU_SDA_PIN, MPU_SCL_PIN, &sensorPreferences);
 #else   // !FEATURE_MPU
-        motion.setup(preferences);
+    motion.setup(&sensorPreferences);
 #endif  // FEATURE_MPU
-        return;
-    }
-    // if (strcmp("status", taskName) == 0) {
-    //     status.setup();
-    //     return;
-    // }
-    if (strcmp("temperature", taskName) == 0) {
+}
+
+void Board::_setupTemperature() {
 #ifdef FEATURE_TEMPERATURE
-        temperature.setup(preferences
+    temperature.setup(&sensorPreferences
 #ifdef FEATURE_TEMPERATURE_COMPENSATION
-                          ,
-                          &tc
+                      ,
+                      &tc
 #endif  // FEATURE_TEMPERATURE_COMPENSATION
-        );
+    );
 #else
-        log_d("no temperature sensor support");
+    log_d("no temperature sensor support");
 #endif  // FEATURE_TEMPERATURE
-        return;
-    }
-    if (strcmp("tc", taskName) == 0) {
+}
+
+void Board::_setupTc() {
 #ifdef FEATURE_TEMPERATURE_COMPENSATION
-        tc.setup(preferences);
+    tc.setup(&sensorPreferences);
 #else
-        log_d("no temperature compensation support");
+    log_d("no temperature compensation support");
 #endif  // FEATURE_TEMPERATURE_COMPENSATION
-        return;
-    }
-    log_e("unknown task: %s", taskName);
 }
 
-void Board::startTasks() {
-#ifdef FEATURE_SERIAL
-    // startTask("wifiSerial");
-#endif
-    // wifi.taskStart("Wifi Task", 1); // Wifi task is empty
-    startTask("bleServer");
-    startTask("battery");
-    if (motionDetectionMethod == MDM_HALL || motionDetectionMethod == MDM_MPU
-#ifdef FEATURE_MPU_TEMPERATURE
-        || true
+void Board::_startTemperature() {
+#ifdef FEATURE_TEMPERATURE
+    temperature.begin();
 #endif
-    ) {
-        startTask("motion");
-    }
-    startTask("strain");
-    startTask("power");
-    // startTask("ota");
-    // startTask("status");
-    startTask("led");
-    startTask("temperature");
-    taskStart(BOARD_TASK_FREQ, 4096 + 1024);
 }
 
-void Board::startTask(const char *taskName) {
-    if (strcmp("bleServer", taskName) == 0) {
-        bleServer.taskStart(BLE_SERVER_TASK_FREQ, bleServer.taskStack);
-        return;
-    }
-    if (strcmp("battery", taskName) == 0) {
-        battery.taskStart(BATTERY_TASK_FREQ);
-        return;
-    }
-    if (strcmp("motion", taskName) == 0) {
-        float freq = -1.0f;
-        if (motionDetectionMethod == MDM_HALL || motionDetectionMethod == MDM_MPU)
-            freq = MOTION_TASK_FREQ;
-        else {
-#ifdef FEATURE_MPU_TEMPERATURE
-            freq = MPU_TEMP_TASK_FREQ;
-#endif
-        }
-        if (0.0f < freq) motion.taskStart(freq);
-        return;
-    }
-    if (strcmp("strain", taskName) == 0) {
-        strain.taskStart(STRAIN_TASK_FREQ);
-        return;
-    }
-    if (strcmp("power", taskName) == 0) {
-        power.taskStart(POWER_TASK_FREQ);
-        return;
-    }
-    // if (strcmp("status", taskName) == 0) {
-    //     status.taskStart(STATUS_TASK_FREQ);
-    //     return;
-    // }
-    if (strcmp("led", taskName) == 0) {
-        led.taskStart(LED_TASK_FREQ);
-        return;
-    }
-    if (strcmp("temperature", taskName) == 0) {
-#ifdef FEATURE_TEMPERATURE
-        temperature.begin();
-#endif
-        return;
-    }
-    log_e("unknown task: %s", taskName);
+void Board::_startMotion() {
+    motion.selectPipeline();
 }
 
-void Board::stopTask(const char *taskName) {
-    if (strcmp("motion", taskName) == 0) {
-        motion.taskStop();
-        return;
-    }
-    log_e("unknown task: %s", taskName);
+void Board::_startStrain() {
+    strain.selectPipeline();
 }
 
-void Board::restartTask(const char *taskName) {
-    log_i("restarting task %s", taskName);
-    stopTask(taskName);
-    startTask(taskName);
+float Board::_motionFreq() {
+    return _motionTaskEnabled() ? motion.taskFreq() : -1.0f;
+}
+
+float Board::_strainFreq() {
+    return strain.taskFreq();
 }
 
 void Board::loop() {
     const ulong t = millis();
+    if (idle)
+        _idleLoop();
+    else if (0 < idleDelay && !otaMode && motion.lastMovement < t && motion.lastMovement + idleDelay <= t)
+        enterIdle();
     const long tSleep = timeUntilDeepSleep(t);
     if (0 == tSleep) {
         log_i("Deep sleep now ...zzzZZZ");
@@ -219,6 +298,7 @@ bool Board::loadSettings() {
         strncpy(hostName, tmpHostName, 32);
     }
     sleepDelay = preferences->getULong("sleepDelay", sleepDelay);
+    idleDelay = preferences->getULong("idleDelay", idleDelay);
     motionDetectionMethod = preferences->getInt("mdm", motionDetectionMethod);
     preferencesEnd();
     return true;
@@ -228,6 +308,7 @@ void Board::saveSettings() {
     if (!preferencesStartSave()) return;
     preferences->putString("hostName", hostName);
     preferences->putULong("sleepDelay", sleepDelay);
+    preferences->putULong("idleDelay", idleDelay);
     preferences->putInt("mdm", motionDetectionMethod);
     preferencesEnd();
 }
@@ -260,6 +341,7 @@ int Board::deepSleep() {
 #endif
     if (!sleepEnabled) return 1;
     log_i("Preparing for deep sleep");
+    _saveRtcState();
     strain.sleep();
 #ifdef FEATURE_MPU
     /*
@@ -289,6 +371,157 @@ int Board::deepSleep() {
     return 0;
 }
 
+// Stops the sensor tasks and advertising and hands crank detection to
+// crankWake, stepped from the board task between light sleeps. Returns false
+// if there is no wake source.
+bool Board::enterIdle() {
+    if (idle) return true;
+    uint8_t source = _idleWakeSource();
+    if (CRANK_WAKE_NONE == source) return false;
+    log_i("entering idle mode, wake source: %s", CRANK_WAKE_HALL == source ? "hall" : "wom");
+    stopTask("strain");
+    stopTask("power");
+    if (_motionTaskEnabled()) stopTask("motion");
+    strain.sleep();
+    if (CRANK_WAKE_HALL == source) {
+        motion.hallSampler.end();
+        crankWake.arm(source, motion.hallThresLow, motion.hallThreshold);
+    } else {
+#ifdef FEATURE_MPU
+        pinMode(MPU_WOM_INT_PIN, INPUT_PULLDOWN);
+        motion.mpuEnableWomSleep();
+#endif
+        crankWake.arm(source);
+    }
+    bleServer.pauseAdvertising();
+    idle = true;
+    taskSetFreq(1000.0f / IDLE_WAKE_PERIOD_MS);
+    return true;
+}
+
+// Resumes the full pipeline.
+void Board::exitIdle() {
+    if (!idle) return;
+    uint8_t source = crankWake.source();
+    log_i("exiting idle mode after %d ticks", crankWake.ticks());
+    idle = false;
+    crankWake.disarm();
+    esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_ALL);
+    if (CRANK_WAKE_WOM == source) gpio_wakeup_disable(MPU_WOM_INT_PIN);
+    bleServer.resumeAdvertising();
+    motion.lastMovement = millis();
+    strain.wake();
+#ifdef FEATURE_MPU
+    if (CRANK_WAKE_WOM == source) motion.mpuWake();
+#else
+    (void)source;
+#endif
+    startTask("strain");
+    startTask("power");
+    if (_motionTaskEnabled()) startTask("motion");
+    taskSetFreq(BOARD_TASK_FREQ);
+}
+
+// One step of the idle mode: feed crankWake, then light sleep until the next
+// step. Advertising is paused in the idle mode, and again if the stack
+// restarted it, e.g. after a disconnect. Light sleep would drop a connection,
+// so while connected the task delay is used instead.
+void Board::_idleLoop() {
+    if (crankWake.onTick()) {
+        exitIdle();
+        return;
+    }
+    const uint8_t source = crankWake.source();
+    if (CRANK_WAKE_HALL == source) {
+        if (crankWake.onHallSample(hall_sensor_read() + motion.hallOffset)) {
+            exitIdle();
+            return;
+        }
+    }
+#ifdef FEATURE_MPU
+    if (CRANK_WAKE_WOM == source && HIGH == digitalRead(MPU_WOM_INT_PIN)) {
+        motion.mpuClearWom();
+        if (crankWake.onWomInterrupt()) {
+            exitIdle();
+            return;
+        }
+    }
+#endif
+    bleServer.pauseAdvertising();
+    if (bleServer.isConnected()) return;
+    esp_sleep_enable_timer_wakeup(IDLE_WAKE_PERIOD_MS * 1000ULL);
+    if (CRANK_WAKE_WOM == source) {
+        // gpio wakeup keeps the pin in the digital domain, unlike ext0
+        gpio_wakeup_enable(MPU_WOM_INT_PIN, GPIO_INTR_HIGH_LEVEL);
+        esp_sleep_enable_gpio_wakeup();
+    }
+    esp_err_t err = esp_light_sleep_start();
+    if (ESP_OK != err) {
+        // once per IDLE_SLEEP_ERROR_LOG_MS instead of every step
+        _sleepErrors++;
+        const ulong t = millis();
+        if (_lastSleepErrorLog + IDLE_SLEEP_ERROR_LOG_MS <= t) {
+            log_e("light sleep error %d (%d times)", err, _sleepErrors);
+            _sleepErrors = 0;
+            _lastSleepErrorLog = t;
+        }
+        return;
+    }
+#ifdef FEATURE_MPU
+    if (ESP_SLEEP_WAKEUP_GPIO == esp_sleep_get_wakeup_cause()) {
+        motion.mpuClearWom();
+        if (crankWake.onWomInterrupt()) exitIdle();
+    }
+#endif
+}
+
+// Keeps the state needed for a fast wake in RTC memory.
+void Board::_saveRtcState() {
+    RtcState::Data *d = rtcState.data;
+    for (uint8_t i = 0; i < strain.numChannels(); i++) {
+        d->tareOffset[i] = (int32_t)strain.channels[i].device->getTareOffset();
+        d->calFactor[i] = strain.channels[i].device->getCalFactor();
+    }
+#ifdef FEATURE_TEMPERATURE_COMPENSATION
+    d->tcOffset = temperature.getCompensationOffset();
+#else
+    d->tcOffset = 0.0f;
+#endif
+    d->revolutions = motion.revolutions;
+    rtcState.commit();
+}
+
+// Restores what the modules did not pick up in their setup, the strain gauges
+// restore their tare offsets and calibration factors in Strain::setup().
+void Board::_restoreRtcState() {
+    const RtcState::Data *d = rtcState.data;
+#ifdef FEATURE_TEMPERATURE_COMPENSATION
+    temperature.setCompensationOffset(d->tcOffset);
+#endif
+    motion.revolutions = d->revolutions;
+    log_i("fast wake, revolutions: %d", d->revolutions);
+}
+
+// Whether the motion task runs with the method, -1: current method.
+bool Board::_motionTaskEnabled(int method) {
+    if (method < 0) method = motionDetectionMethod;
+    if (MDM_FUSED == method) return false;  // the strain task polls the MPU
+#ifdef FEATURE_MPU_TEMPERATURE
+    return true;
+#endif
+    return mdmUsesMotionTask(method);
+}
+
+// The idle mode crank detection: the hall sensor when it's the detection
+// method, otherwise wake-on-motion if there is an MPU.
+uint8_t Board::_idleWakeSource() {
+    if (MDM_HALL == motionDetectionMethod) return CRANK_WAKE_HALL;
+#ifdef FEATURE_MPU
+    if (nullptr != motion.mpu) return CRANK_WAKE_WOM;
+#endif
+    return CRANK_WAKE_NONE;
+}
+
 void Board::reboot() {
     api.notifyTxChar("Rebooting...");
     delay(500);
@@ -312,12 +545,32 @@ void Board::setSleepDelay(const ulong delay) {
 }
 
 void Board::setMotionDetectionMethod(int method) {
+    if (idle) exitIdle();
     int prevMDM = motionDetectionMethod;
+    bool wasSetUp = mdmUsesMotionTask(prevMDM) || mdmUsesMpu(prevMDM);
+#ifdef FEATURE_MPU_TEMPERATURE
+    wasSetUp = true;
+#endif
+#ifdef FEATURE_MPU
+    if (mdmUsesMpu(method) && nullptr == motion.mpu) wasSetUp = false;
+#endif
+    // stop the motion task first, in MDM_FUSED the strain task polls the MPU
+    if (_motionTaskEnabled(prevMDM)) stopTask("motion");
     motionDetectionMethod = method;
-    if ((prevMDM == MDM_HALL || prevMDM == MDM_MPU) && (method != MDM_HALL && method != MDM_MPU)) {
-        stopTask("motion");
-    } else if ((prevMDM != MDM_HALL && prevMDM != MDM_MPU) && (method == MDM_HALL || method == MDM_MPU)) {
-        setupTask("motion");
-        startTask("motion");
-    }
+    if (!wasSetUp && (mdmUsesMotionTask(method) || mdmUsesMpu(method))) setupTask("motion");
+    if (_motionTaskEnabled(method)) startTask("motion");
+    if (MDM_STRAIN == prevMDM || MDM_FUSED == prevMDM || MDM_STRAIN == method || MDM_FUSED == method)
+        restartTask("strain");
+    if (bleServer.cpmFields & CPM_FIELDS_ANGLES)
+        bleServer.updateCpFormat();  // the crank angle fields depend on the method
+}
+
+bool Board::mdmUsesMpu(int method) {
+    if (method < 0) method = motionDetectionMethod;
+    return method == MDM_MPU || method == MDM_MPU_GYRO || method == MDM_FUSED;
+}
+
+bool Board::mdmUsesMotionTask(int method) {
+    if (method < 0) method = motionDetectionMethod;
+    return method == MDM_HALL || method == MDM_MPU || method == MDM_MPU_GYRO;
 }
@@ -31,6 +31,10 @@
 #include "motion.h"
 #include "strain.h"
 #include "power.h"
+#include "cadence.h"
+#include "crank_wake.h"
+#include "rtc_state.h"
+#include "boot_profile.h"
 // #include "status.h"
 #include "led.h"
 #include "atoll_log.h"
@@ -41,6 +45,7 @@ class Board : public Atoll::Task,
    public:
     const char *taskName() { return "Board"; }
     ::Preferences arduinoPreferences = ::Preferences();
+    ::Preferences sensorPreferences = ::Preferences();  // the sensor modules are set up concurrently, see setup()
 #ifdef FEATURE_SERIAL
     HardwareSerial hwSerial = HardwareSerial(0);
     Atoll::WifiSerial wifiSerial;
@@ -52,6 +57,7 @@ class Board : public Atoll::Task,
     Motion motion;
     Strain strain;
     Power power;
+    Cadence cadence;
     Atoll::Ota ota;
     // Status status;
     Led led;
@@ -66,32 +72,110 @@ class Board : public Atoll::Task,
     bool otaMode = false;
     bool sleepEnabled = true;
     ulong sleepDelay = SLEEP_DELAY_DEFAULT;
+    ulong idleDelay = IDLE_DELAY_DEFAULT;
+    bool idle = false;  // sensor tasks are stopped, crank detection runs in crankWake
+    CrankWake crankWake;
+    RtcState rtcState;
+    BootProfile bootProfile;
+    bool fastWake = false;  // woke from deep sleep with valid RTC state, see setup()
     char hostName[SETTINGS_STR_LENGTH] = HOSTNAME;
     uint8_t motionDetectionMethod = MOTION_DETECTION_METHOD;
 
+    // Task registry entry, modules without a task are only set up (and started if onStart is set).
+    struct TaskEntry {
+        const char *name;
+        void (Board::*setup)();
+        Atoll::Task *task;         // nullptr if the module has no task
+        void (Board::*onStart)();  // called when started, before taskStart() if there is a task
+        float (Board::*freqFn)();  // start frequency if set, otherwise freq
+        float freq;                // start frequency in Hz, <= 0: not started
+        uint32_t stack;            // 0: task default
+        int8_t priority;           // -1: task default
+        bool autoStart;            // started by startTasks()
+        bool running;
+        float runningFreq;
+    };
+
     void setup();
+    TaskEntry *task(const char *taskName);
+    TaskEntry *taskAt(uint8_t index);
     void setupTask(const char *taskName);
     void startTasks();
-    void startTask(const char *taskName);
-    void stopTask(const char *taskName);
+    bool startTask(const char *taskName);
+    bool stopTask(const char *taskName);
     void restartTask(const char *taskName);
+    bool setTaskFreq(const char *taskName, float freq);
+    bool setTaskPriority(const char *taskName, int8_t priority);
     void loop();
     bool loadSettings();
     void saveSettings();
     // Returns time in ms until entering deep sleep, or -1 in case of no such plans.
     long timeUntilDeepSleep(ulong t = 0);
     int deepSleep();
+    bool enterIdle();
+    void exitIdle();
     void reboot();
     float getStrain(bool clearBuffer = false);
     float getLiveStrain();
     float getPower(bool clearBuffer = false);
     void setSleepDelay(const ulong delay);
     void setMotionDetectionMethod(int method);
+    bool mdmUsesMpu(int method = -1);         // whether the method needs the MPU, -1: current method
+    bool mdmUsesMotionTask(int method = -1);  // whether the method detects crank events in the motion task
 
    private:
+    // in setup and start order
+    TaskEntry _tasks[BOARD_TASKS] = {
+        // name, setup, task, onStart, freqFn, freq, stack, priority, autoStart
+        {"bleServer", &Board::_setupBleServer, &bleServer, nullptr, nullptr, BLE_SERVER_TASK_FREQ, 0, -1, true},
+        {"api", &Board::_setupApi, nullptr, nullptr, nullptr, 0.0f, 0, -1, false},
+        {"ota", &Board::_setupOta, &ota, nullptr, nullptr, OTA_TASK_FREQ, 0, -1, false},
+        {"led", &Board::_setupLed, &led, nullptr, nullptr, LED_TASK_FREQ, 0, -1, true},
+        {"wifi", &Board::_setupWifi, nullptr, nullptr, nullptr, 0.0f, 0, -1, false},
+        {"battery", &Board::_setupBattery, &battery, nullptr, nullptr, BATTERY_TASK_FREQ, 0, -1, true},
+        {"motion", &Board::_setupMotion, &motion, &Board::_startMotion, &Board::_motionFreq, 0.0f, 0, -1, true},
+        {"strain", &Board::_setupStrain, &strain, &Board::_startStrain, &Board::_strainFreq, 0.0f, 0, -1, true},
+        {"power", &Board::_setupPower, &power, nullptr, nullptr, POWER_TASK_FREQ, 0, -1, true},
+        {"cadence", &Board::_setupCadence, nullptr, nullptr, nullptr, 0.0f, 0, -1, false},
+        {"temperature", &Board::_setupTemperature, nullptr, &Board::_startTemperature, nullptr, 0.0f, 0, -1, true},
+        {"tc", &Board::_setupTc, nullptr, nullptr, nullptr, 0.0f, 0, -1, false},
+    };
+
+    void _setupLed();
+    void _setupWifi();
+    void _setupBleServer();
+    void _setupApi();
+    void _setupOta();
+    void _setupBattery();
+    void _setupStrain();
+    void _setupPower();
+    void _setupCadence();
+    void _setupMotion();
+    void _setupTemperature();
+    void _setupTc();
+    void _startTemperature();
+    void _startMotion();
+    void _startStrain();
+    float _motionFreq();
+    float _strainFreq();
+
     const ulong _sleepCountdownAfter = SLEEP_COUNTDOWN_AFTER;
     const ulong _sleepCountdownEvery = SLEEP_COUNTDOWN_EVERY;
     ulong _lastSleepCountdown = 0;
+    ulong _lastSleepErrorLog = 0;
+    uint32_t _sleepErrors = 0;  // light sleep errors since the last log
+
+    bool _motionTaskEnabled(int method = -1);
+    uint8_t _idleWakeSource();
+    void _idleLoop();
+    void _saveRtcState();
+
+    EventGroupHandle_t _bootEvents = nullptr;
+
+    void _timedSetupTask(const char *taskName);
+    void _setupSensors(bool waitForApi);
+    static void _sensorSetupTask(void *arg);
+    void _restoreRtcState();
 };
 
 extern Board board;
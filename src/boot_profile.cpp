@@ -0,0 +1,59 @@
+#include "boot_profile.h"
+
+#include <esp_timer.h>
+
+int8_t BootProfile::start(const char *name) {
+    int8_t index = -1;
+    portENTER_CRITICAL(&_mux);
+    if (_size < BOOT_PROFILE_STAGES) index = _size++;
+    portEXIT_CRITICAL(&_mux);
+    if (index < 0) {
+        log_e("table full");
+        return -1;
+    }
+    Stage *s = &_stages[index];
+    s->name = name;
+    s->startUs = (uint32_t)esp_timer_get_time();
+    s->durationUs = 0;
+    s->core = (uint8_t)xPortGetCoreID();
+    return index;
+}
+
+void BootProfile::end(int8_t index) {
+    if (index < 0 || _size <= index) return;
+    Stage *s = &_stages[index];
+    s->durationUs = (uint32_t)esp_timer_get_time() - s->startUs;
+    log_d("%s: %.1fms", s->name, s->durationUs / 1000.0f);
+}
+
+void BootProfile::mark(const char *name) {
+    int8_t index = start(name);
+    if (0 <= index) log_i("%s at %.1fms", name, _stages[index].startUs / 1000.0f);
+}
+
+uint8_t BootProfile::size() {
+    return _size;
+}
+
+const BootProfile::Stage *BootProfile::stage(uint8_t index) {
+    if (_size <= index) return nullptr;
+    return &_stages[index];
+}
+
+// Prints "name:start+duration@core;" for each stage, times in ms.
+size_t BootProfile::print(char *buf, size_t size) {
+    size_t len = 0;
+    if (0 < size) buf[0] = '\0';
+    for (uint8_t i = 0; i < _size && len < size; i++) {
+        const Stage *s = &_stages[i];
+        int written = snprintf(buf + len, size - len, "%s%s:%.1f+%.1f@%d",
+                               0 < i ? ";" : "",
+                               s->name,
+                               s->startUs / 1000.0f,
+                               s->durationUs / 1000.0f,
+                               s->core);
+        if (written < 0) break;
+        len += written;
+    }
+    return len < size ? len : size - 1;
+}
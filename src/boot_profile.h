@@ -0,0 +1,35 @@
+#ifndef BOOT_PROFILE_H
+#define BOOT_PROFILE_H
+
+#include <Arduino.h>
+
+#ifndef BOOT_PROFILE_STAGES
+#define BOOT_PROFILE_STAGES 24  // maximum number of recorded stages and marks
+#endif
+
+// Boot stage timings, relative to the start of the application. Stages may be
+// timed concurrently from both cores; marks are stages without a duration,
+// e.g. the first CPM notification.
+class BootProfile {
+   public:
+    struct Stage {
+        const char *name;
+        uint32_t startUs;
+        uint32_t durationUs;
+        uint8_t core;
+    };
+
+    int8_t start(const char *name);  // returns the stage index, -1 if full
+    void end(int8_t index);
+    void mark(const char *name);
+    uint8_t size();
+    const Stage *stage(uint8_t index);
+    size_t print(char *buf, size_t size);
+
+   protected:
+    Stage _stages[BOOT_PROFILE_STAGES];
+    uint8_t _size = 0;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+#endif
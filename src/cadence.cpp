@@ -0,0 +1,87 @@
+#include "cadence.h"
+#include "board.h"
+
+void Cadence::setup(::Preferences *p, const char *preferencesNS) {
+    preferencesSetup(p, preferencesNS);
+    loadSettings();
+    printSettings();
+    addApiCommand();
+}
+
+// Returns the tracked cadence, 0 if unknown or stale.
+float Cadence::rpm(ulong t) {
+    if (0 == t) t = millis();
+    return CadenceTracker::rpm(t);
+}
+
+void Cadence::loadSettings() {
+    if (!preferencesStartLoad()) return;
+    alpha = preferences->getFloat("alpha", alpha);
+    beta = preferences->getFloat("beta", beta);
+    tolerance = preferences->getFloat("tolerance", tolerance);
+    preferencesEnd();
+}
+
+void Cadence::saveSettings() {
+    if (!preferencesStartSave()) return;
+    preferences->putFloat("alpha", alpha);
+    preferences->putFloat("beta", beta);
+    preferences->putFloat("tolerance", tolerance);
+    preferencesEnd();
+}
+
+void Cadence::printSettings() {
+    log_i("alpha: %.2f, beta: %.2f, tolerance: %.2f", alpha, beta, tolerance);
+}
+
+void Cadence::addApiCommand() {
+    board.api.addCommand(Api::Command("ct", [this](Api::Message *m) { return cadenceProcessor(m); }));
+}
+
+Api::Result *Cadence::cadenceProcessor(Api::Message *msg) {
+    // get/set tracker params: ct[=alpha:float;beta:float;tol:float;] -> alpha:float;beta:float;tol:float;rpm:float;rejected:uint;missed:uint;
+    if (0 < strlen(msg->arg)) {
+        uint8_t changed = 0;
+        char buf[8] = "";
+        if (msg->argGetParam("alpha:", buf, sizeof(buf))) {
+            float f = atof(buf);
+            if (f <= 0.0f || 1.0f < f) {
+                msg->replyAppend("alpha out of range (0...1)");
+                return Api::argInvalid();
+            }
+            alpha = f;
+            changed++;
+        }
+        if (msg->argGetParam("beta:", buf, sizeof(buf))) {
+            float f = atof(buf);
+            if (f <= 0.0f || 1.0f < f) {
+                msg->replyAppend("beta out of range (0...1)");
+                return Api::argInvalid();
+            }
+            beta = f;
+            changed++;
+        }
+        if (msg->argGetParam("tol:", buf, sizeof(buf))) {
+            float f = atof(buf);
+            if (f < 0.05f || 0.45f < f) {
+                msg->replyAppend("tol out of range (0.05...0.45)");
+                return Api::argInvalid();
+            }
+            tolerance = f;
+            changed++;
+        }
+        if (!changed) {
+            msg->replyAppend("[alpha:float;beta:float;tol:float;]");
+            return Api::argInvalid();
+        }
+        saveSettings();
+    }
+    snprintf(msg->reply, sizeof(msg->reply), "alpha:%.2f;beta:%.2f;tol:%.2f;rpm:%.1f;rejected:%d;missed:%d;",
+             alpha,
+             beta,
+             tolerance,
+             rpm(),
+             rejected,
+             missed);
+    return Api::success();
+}
@@ -0,0 +1,26 @@
+#ifndef CADENCE_H
+#define CADENCE_H
+
+#include <Arduino.h>
+
+#include "definitions.h"
+#include "atoll_preferences.h"
+#include "api.h"
+#include "cadence_tracker.h"
+
+// Cadence tracker of the board, see CadenceTracker, with its settings and API command.
+class Cadence : public CadenceTracker,
+                public Atoll::Preferences {
+   public:
+    void setup(::Preferences *p, const char *preferencesNS = "CADENCE");
+    float rpm(ulong t = 0);
+
+    void loadSettings();
+    void saveSettings();
+    void printSettings();
+
+    void addApiCommand();
+    Api::Result *cadenceProcessor(Api::Message *msg);
+};
+
+#endif
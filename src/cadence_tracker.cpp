@@ -0,0 +1,125 @@
+#include "cadence_tracker.h"
+
+// Processes a crank event detected at time t (ms), O(1). The event is
+// classified in ms, the time per revolution is also reported from the µs
+// time of the event, us < 0: derived from t.
+CadenceTracker::Event CadenceTracker::onEvent(const ulong t, int64_t us) {
+    Event e;
+    if (us < 0) us = (int64_t)t * 1000;
+    if (0 == lastEventTime || CADENCE_TIMEOUT_MS < t - lastEventTime) {
+        // first event or restart after a pause
+        reset();
+        lastEventTime = t;
+        lastEventUs = us;
+        e.restarted = true;
+        return e;
+    }
+    const ulong dt = t - lastEventTime;
+    const uint32_t dtUs = (uint32_t)(us - lastEventUs);
+    if (dt <= CRANK_EVENT_MIN_MS) {
+        rejected++;
+        return e;
+    }
+    if (_period <= 0.0f) {
+        _seed(t, us, dt);
+        e.revolutions = 1;
+        e.dt = dt;
+        e.dtUs = dtUs;
+        return e;
+    }
+    const float ratio = dt / _period;
+    if (1.0f - tolerance <= ratio && ratio <= 1.0f + tolerance) {
+        // an interval spanning a rejected event does not end a streak, it may
+        // be two real revolutions of a rider who sped up
+        if (!_merged) {
+            _streak = 0;
+            _streakRejected = 0;
+        }
+        _merged = false;
+        _update(t, us, 1);
+        e.revolutions = 1;
+        e.dt = dt;
+        e.dtUs = dtUs;
+        return e;
+    }
+    if (CADENCE_MAX_STREAK <= ++_streak) {
+        // the period no longer matches, the events rejected in the streak
+        // were real revolutions
+        e.revolutions = 1 + _streakRejected;
+        e.dt = dt;
+        e.dtUs = dtUs;
+        _seed(t, us, dt);
+        return e;
+    }
+    if (0.5f - tolerance <= ratio && ratio <= 0.5f + tolerance) {
+        // half period: double detection
+        rejected++;
+        _streakRejected++;
+        _merged = true;
+        return e;
+    }
+    _merged = false;
+    if (2.0f - tolerance <= ratio && ratio <= 2.0f + tolerance) {
+        // double period: missed detection
+        missed++;
+        _update(t, us, 2);
+        e.revolutions = 2;
+        e.dt = dt / 2;
+        e.dtUs = dtUs / 2;
+        return e;
+    }
+    // outlier: one revolution, the period is kept until the streak re-seeds it
+    lastEventTime = t;
+    lastEventUs = us;
+    _phase = 0.0f;
+    e.revolutions = 1;
+    e.dt = dt;
+    e.dtUs = dtUs;
+    return e;
+}
+
+void CadenceTracker::reset() {
+    _period = 0.0f;
+    _streak = 0;
+    _streakRejected = 0;
+    _merged = false;
+}
+
+// Returns the predicted time of the next event, 0 if unknown.
+ulong CadenceTracker::predictNext() {
+    if (_period <= 0.0f) return 0;
+    return lastEventTime + (long)(_phase + _period);
+}
+
+// Returns the tracked cadence at time t, 0 if unknown or stale.
+float CadenceTracker::rpm(const ulong t) {
+    if (_period <= 0.0f) return 0.0f;
+    if (CADENCE_TIMEOUT_MS < t - lastEventTime) return 0.0f;
+    return 60000.0f / _period;
+}
+
+// Returns the predicted period in ms, 0 if unknown.
+float CadenceTracker::period() {
+    return _period;
+}
+
+void CadenceTracker::_seed(const ulong t, const int64_t us, const ulong dt) {
+    _period = dt;
+    _phase = 0.0f;
+    _streak = 0;
+    _streakRejected = 0;
+    _merged = false;
+    lastEventTime = t;
+    lastEventUs = us;
+}
+
+// Alpha-beta update with an event at time t, the given number of revolutions
+// after the last accepted event. The filtered event time is kept relative to
+// lastEventTime to avoid losing float precision on large millis() values.
+void CadenceTracker::_update(const ulong t, const int64_t us, const uint8_t revolutions) {
+    float residual = (float)(t - lastEventTime) - _phase - revolutions * _period;
+    _phase = (alpha - 1.0f) * residual;
+    _period += beta * residual / revolutions;
+    lastEventTime = t;
+    lastEventUs = us;
+}
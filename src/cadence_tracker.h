@@ -0,0 +1,77 @@
+#ifndef CADENCE_TRACKER_H
+#define CADENCE_TRACKER_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <sys/types.h>
+#endif
+
+// defaults for host builds, the firmware takes them from definitions.h
+#ifndef CRANK_EVENT_MIN_MS
+#define CRANK_EVENT_MIN_MS 400
+#endif
+#ifndef CADENCE_ALPHA
+#define CADENCE_ALPHA 0.5f
+#endif
+#ifndef CADENCE_BETA
+#define CADENCE_BETA 0.2f
+#endif
+#ifndef CADENCE_TOLERANCE
+#define CADENCE_TOLERANCE 0.25f
+#endif
+#ifndef CADENCE_TIMEOUT_MS
+#define CADENCE_TIMEOUT_MS 3000
+#endif
+#ifndef CADENCE_MAX_STREAK
+#define CADENCE_MAX_STREAK 3
+#endif
+
+// Alpha-beta tracker of crank events: predicts the next event, flags double
+// detections (half periods) and missed events (double periods), and supplies
+// a robust time per revolution.
+// Intervals are classified by their ratio to the predicted period:
+//   1 ± tolerance: tracked
+//   0.5 ± tolerance: double detection, rejected
+//   2 ± tolerance: missed detection, counted as two revolutions
+//   anything else: outlier, counted as one revolution
+// After CADENCE_MAX_STREAK consecutive intervals that are not tracked the
+// period is re-seeded, so a rider who speeds up or slows down by more than
+// the tolerance within one revolution is followed within a few revolutions.
+// No Arduino dependencies, so it can be tested on the host.
+class CadenceTracker {
+   public:
+    struct Event {
+        uint8_t revolutions = 0;  // revolutions to count, 0 if the event was rejected
+        ulong dt = 0;             // time per revolution in ms
+        uint32_t dtUs = 0;        // time per revolution in µs
+        bool restarted = false;   // first event or first event after a pause
+    };
+
+    float alpha = CADENCE_ALPHA;          // phase gain
+    float beta = CADENCE_BETA;            // period gain
+    float tolerance = CADENCE_TOLERANCE;  // outlier tolerance, fraction of the predicted period
+    ulong lastEventTime = 0;              // time of the last accepted event
+    int64_t lastEventUs = 0;              // µs time of the last accepted event
+    uint32_t rejected = 0;                // number of events rejected as double detections
+    uint32_t missed = 0;                  // number of events filled in as missed detections
+
+    Event onEvent(const ulong t, int64_t us = -1);
+    void reset();
+    ulong predictNext();
+    float rpm(const ulong t);
+    float period();
+
+   protected:
+    float _period = 0.0f;  // predicted period in ms, 0 if unknown
+    float _phase = 0.0f;   // filtered time of the last accepted event, relative to lastEventTime
+    uint8_t _streak = 0;          // consecutive intervals that did not match the period
+    uint8_t _streakRejected = 0;  // events rejected as double detections during the streak
+    bool _merged = false;         // the next interval spans a rejected event
+
+    void _seed(const ulong t, const int64_t us, const ulong dt);
+    void _update(const ulong t, const int64_t us, const uint8_t revolutions);
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef CRANK_DETECTOR_H
+#define CRANK_DETECTOR_H
+
+// Two-threshold crank event detector shared by the hall and strain pipelines:
+// arms when the value drops to the low threshold and fires once when it
+// reaches the high threshold.
+template <typename T>
+class HysteresisDetector {
+   public:
+    // Returns true on a crank event.
+    bool update(const T value, const T low, const T high) {
+        if (!_armed) {
+            if (value <= low) _armed = true;
+            return false;
+        }
+        if (value < high) return false;
+        _armed = false;
+        return true;
+    }
+
+    void reset() { _armed = false; }
+
+   protected:
+    bool _armed = false;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "crank_fusion.h"
+
+bool CrankFusion::update(const bool strainTrigger, const float angle, const float rpm, const ulong t, ulong *eventTime) {
+    if (_hasAngle) {
+        float delta = angle - _previousAngle;
+        if (180.0f < delta)
+            delta -= 360.0f;
+        else if (delta < -180.0f)
+            delta += 360.0f;
+        _advance += delta;
+        if (_advance < 0.0f) _advance = 0.0f;  // backpedalling does not count
+    }
+    _previousAngle = angle;
+    _hasAngle = true;
+    const bool rotating = FUSION_MIN_RPM <= rpm;
+    if (strainTrigger) {
+        if (!rotating) {
+            counters.rejectedStill++;
+            return false;
+        }
+        if (_advance < FUSION_MIN_ADVANCE) {
+            counters.rejectedEarly++;
+            return false;
+        }
+        counters.accepted++;
+        _advance = 0.0f;
+        *eventTime = t;
+        return true;
+    }
+    if (rotating && 360.0f + FUSION_FILL_MARGIN <= _advance) {
+        counters.filled++;
+        _advance -= 360.0f;
+        // the revolution was completed _advance degrees ago
+        *eventTime = t - (ulong)(_advance / (rpm * 6.0f) * 1000.0f);
+        return true;
+    }
+    return false;
+}
+
+void CrankFusion::reset() {
+    _advance = 0.0f;
+    _hasAngle = false;
+}
+
+void CrankFusion::resetCounters() {
+    counters = Counters();
+}
@@ -0,0 +1,45 @@
+#ifndef CRANK_FUSION_H
+#define CRANK_FUSION_H
+
+#include <Arduino.h>
+
+#ifndef FUSION_MIN_RPM
+#define FUSION_MIN_RPM 15.0f  // minimum gyro cadence to accept a strain trigger
+#endif
+#ifndef FUSION_MIN_ADVANCE
+#define FUSION_MIN_ADVANCE 180.0f  // minimum crank advance in degrees between accepted events
+#endif
+#ifndef FUSION_FILL_MARGIN
+#define FUSION_FILL_MARGIN 90.0f  // crank advance in degrees beyond a revolution before a missed event is filled in
+#endif
+
+// Cross-validates strain threshold crossings against the crank angle from the
+// MPU gyro. A strain trigger is accepted only while the crank is rotating and
+// at least half a revolution after the previous event, which rejects bumps and
+// the second peak of standing pedalling. When a revolution passes without a
+// trigger, e.g. at low torque, the event is filled in from the angle.
+// Constant cost per sample.
+class CrankFusion {
+   public:
+    struct Counters {
+        uint32_t accepted = 0;       // strain triggers confirmed by the MPU
+        uint32_t filled = 0;         // events inserted from the MPU angle
+        uint32_t rejectedStill = 0;  // strain triggers without rotation
+        uint32_t rejectedEarly = 0;  // strain triggers too soon after the previous event
+    };
+
+    Counters counters;
+
+    // Feeds a sample taken at time t, returns true and sets eventTime if a
+    // crank event should be counted.
+    bool update(const bool strainTrigger, const float angle, const float rpm, const ulong t, ulong *eventTime);
+    void reset();
+    void resetCounters();
+
+   protected:
+    float _previousAngle = 0.0f;
+    float _advance = 0.0f;  // forward crank advance since the last event
+    bool _hasAngle = false;
+};
+
+#endif
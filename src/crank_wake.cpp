@@ -0,0 +1,52 @@
+#include "crank_wake.h"
+
+void CrankWake::arm(uint8_t source, int16_t thresLow, int16_t thresHigh) {
+    _s = {};
+    _s.source = source;
+    _s.thresLow = thresLow;
+    _s.thresHigh = thresHigh;
+}
+
+void CrankWake::disarm() {
+    _s.source = CRANK_WAKE_NONE;
+}
+
+// Advances time by one wakeup period, returns whether the pipeline should resume.
+bool CrankWake::onTick() {
+    _s.ticks++;
+    if (CRANK_WAKE_WOM == _s.source && 0 < _s.events && CRANK_WAKE_WOM_WINDOW < _s.ticks - _s.since)
+        _s.events = 0;
+    return _s.fired;
+}
+
+// Feeds an offset corrected hall reading.
+bool CrankWake::onHallSample(int value) {
+    if (CRANK_WAKE_HALL != _s.source || _s.fired) return _s.fired;
+    if (value < 0) value = -value;
+    if (0 == _s.phase) {
+        if (value < _s.thresLow) _s.phase = 1;
+    } else if (_s.thresHigh < value) {
+        _s.fired = 1;
+    }
+    return _s.fired;
+}
+
+bool CrankWake::onWomInterrupt() {
+    if (CRANK_WAKE_WOM != _s.source || _s.fired) return _s.fired;
+    if (0 == _s.events) _s.since = _s.ticks;
+    _s.events++;
+    if (CRANK_WAKE_WOM_EVENTS <= _s.events) _s.fired = 1;
+    return _s.fired;
+}
+
+bool CrankWake::fired() {
+    return 0 < _s.fired;
+}
+
+uint8_t CrankWake::source() {
+    return _s.source;
+}
+
+uint32_t CrankWake::ticks() {
+    return _s.ticks;
+}
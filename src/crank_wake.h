@@ -0,0 +1,55 @@
+#ifndef CRANK_WAKE_H
+#define CRANK_WAKE_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#endif
+
+#define CRANK_WAKE_NONE 0  // no low power wake source
+#define CRANK_WAKE_HALL 1  // periodic hall sensor samples
+#define CRANK_WAKE_WOM 2   // MPU wake-on-motion interrupts
+
+#ifndef CRANK_WAKE_WOM_EVENTS
+#define CRANK_WAKE_WOM_EVENTS 2  // interrupts needed within the window to resume
+#endif
+#ifndef CRANK_WAKE_WOM_WINDOW
+#define CRANK_WAKE_WOM_WINDOW 50  // window in ticks
+#endif
+
+// Crank detection state machine for the low power idle mode.
+// It is stepped once per wakeup of the main core and keeps all state in a
+// small POD, in the shape a ULP program would, so it can be simulated on
+// the host by feeding it samples.
+// Hall: one low->high transition with the same hysteresis as Motion, i.e. a
+// single magnet pass resumes the pipeline.
+// WOM: CRANK_WAKE_WOM_EVENTS interrupts within CRANK_WAKE_WOM_WINDOW ticks,
+// a single knock of the parked bike is ignored.
+class CrankWake {
+   public:
+    struct State {
+        uint8_t source;
+        uint8_t phase;     // hall: 0 waiting for low, 1 waiting for high
+        uint8_t events;    // wom: interrupts in the current window
+        uint8_t fired;     // the pipeline should resume
+        uint32_t ticks;    // steps since arming
+        uint32_t since;    // wom: tick of the first interrupt in the window
+        int16_t thresLow;  // hall thresholds
+        int16_t thresHigh;
+    };
+
+    void arm(uint8_t source, int16_t thresLow = 0, int16_t thresHigh = 0);
+    void disarm();
+    bool onTick();
+    bool onHallSample(int value);
+    bool onWomInterrupt();
+    bool fired();
+    uint8_t source();
+    uint32_t ticks();
+
+   protected:
+    State _s = {};
+};
+
+#endif
@@ -14,19 +14,46 @@
 #define BLE_SERVER_TASK_FREQ 1.0f           //
 #define BATTERY_TASK_FREQ 1.0f              //
 #define MOTION_TASK_FREQ 125.0f             //
+#define MOTION_FIFO_TASK_FREQ 20.0f         // motion task frequency when the MPU FIFO is drained in bursts
 #define MPU_TEMP_TASK_FREQ 1.0f             //
-#define STRAIN_TASK_FREQ 90.0f              //
+#define STRAIN_TASK_FREQ 90.0f              // HX711 @ 80 sps
+#define STRAIN_IDLE_TASK_FREQ 12.0f         // HX711 @ 10 sps
 #define POWER_TASK_FREQ 90.0f               //
 #define OTA_TASK_FREQ 1.0f                  //
 #define LED_TASK_FREQ 10.0f                 //
+#define BOARD_TASKS 12                      // number of entries in the task registry
+;                                           //
+#define BLE_SENDER_TASK_PRIORITY 5          // CPM/CSC sender woken by crank events, above the polled tasks
+#define BLE_SENDER_TASK_STACK 4096          //
+#define BLE_REQUEST_TASK_PRIORITY 1         // control point and binary api requests, below the sender
+#define BLE_REQUEST_TASK_STACK 8192         // requests tare, write preferences and restart tasks
+#define BLE_NOTIFY_RETRIES 20               // attempts to send a binary api frame while the host is out of buffers
+#define BLE_NOTIFY_RETRY_MS 30              // delay between the attempts, about a connection interval
+#define BLE_CP_HEARTBEAT_MS 1000            // CPM is updated at least this often without crank events
+#define BLE_CSC_HEARTBEAT_MS 1500           // CSCM is updated at least this often without crank events
+#define BLE_GATE_CPM_HEARTBEAT_MS 3000      // CPM is sent at least this often even if unchanged
+#define BLE_GATE_CSCM_HEARTBEAT_MS 3000     // CSCM is sent at least this often even if unchanged
+#define BLE_GATE_WM_DEADBAND 0.01f          // minimum weight change in kg to notify WM
+#define BLE_GATE_WM_HEARTBEAT_MS 5000       //
+#define BLE_GATE_HALL_HEARTBEAT_MS 1000     //
+#define BLE_CONN_IDLE_MS 10 * 1000          // time without movement before relaxing the connection parameters
+#define BLE_CONN_UPDATE_MIN_MS 5000         // minimum time between connection parameter requests, also after connecting
+;                                           //
+#define BOOT_SENSOR_CORE 0                  // core of the sensor setup task, NimBLE runs on core 1
+#define BOOT_SENSOR_TASK_STACK 4096 + 2048  //
+#define BOOT_API_READY (1 << 0)             // boot event: API commands may be added
+#define BOOT_SENSORS_READY (1 << 1)         // boot event: sensor modules are set up
 ;                                           //
 #define SLEEP_DELAY_DEFAULT 5 * 60 * 1000   // 5m
 #define SLEEP_DELAY_MIN 1 * 60 * 1000       // 1m
 #define SLEEP_COUNTDOWN_AFTER 30 * 1000     // 30s countdown on the serial console
 #define SLEEP_COUNTDOWN_EVERY 2000          // 2s
+#define IDLE_DELAY_DEFAULT 30 * 1000        // 30s without movement before entering low power idle, 0: disabled
+#define IDLE_WAKE_PERIOD_MS 20              // crank detection period in low power idle
+#define IDLE_SLEEP_ERROR_LOG_MS 10 * 1000   // minimum time between light sleep error logs
 ;                                           //
 #define MPU_RINGBUF_SIZE 16                 // 128 ms smoothing @ 125 sps // TODO unused
-#define STRAIN_RINGBUF_SIZE 512             // 80 sps @ 10 rpm = 480 samples/rev
+#define STRAIN_RINGBUF_SIZE 512             // 6.4 s @ 80 sps, 51.2 s @ 10 sps
 #define POWER_RINGBUF_SIZE 2                // 3 sec smoothing @ 100 rpm
 #define WIFISERIAL_RINGBUF_RX_SIZE 256      //
 #define WIFISERIAL_RINGBUF_TX_SIZE 1024     // largest string to be printed should fit
@@ -40,9 +67,19 @@
 #define MPU_SDA_PIN GPIO_NUM_23             //
 #define MPU_SCL_PIN GPIO_NUM_33             //
 #define MPU_WOM_INT_PIN GPIO_NUM_4          // rtc gpio for wake-on-motion interrupt
-;                                           //
-#define STRAIN_DOUT_PIN GPIO_NUM_5          //
+#define MPU_GYRO_MIN_DPS 60.0f              // minimum crank rate for a gyro crank event (60 dps = 10 RPM)
+#define MPU_RATE_IDLE_MS 5000               // time without crank events before the MPU drops to its lowest rate
+#define MPU_RATE_HYSTERESIS 0.85f           // fraction of a profile's cadence limit to move back down
+#define MPU_GRAVITY_CORRECTION 0.5f         // fraction of the gravity angle error corrected once per revolution
+#define MPU_GRAVITY_MIN_SAMPLES 16          // minimum accel samples in a revolution for the gravity correction
+;                                           //
+#define STRAIN_CHANNELS 1                   // number of HX711s, 1: right crank, 2: right and left crank
+#define STRAIN_DOUT_PIN GPIO_NUM_5          // right
 #define STRAIN_SCK_PIN GPIO_NUM_13          //
+#define STRAIN_LEFT_DOUT_PIN GPIO_NUM_18    // left
+#define STRAIN_LEFT_SCK_PIN GPIO_NUM_19     //
+#define STRAIN_RATE_PIN GPIO_NUM_NC         // HX711 RATE pin(s), high: 80 sps, low: 10 sps, GPIO_NUM_NC if hardwired
+#define STRAIN_IDLE_RATE_MS 10000           // switch HX711 to 10 sps after this long without movement
 ;                                           //
 #define TEMPERATURE_PIN GPIO_NUM_32         // onewire ds18b20 parasitic
 ;                                           //
@@ -50,11 +87,15 @@
 #define HX711_IGN_HIGH_SAMPLE 1             // adds extra sample(s) to the dataset and ignores peak high/low sample, value must be 0 or 1.
 #define HX711_IGN_LOW_SAMPLE 1              //
 #define HX711_SCK_DELAY 1                   // microsecond delay after writing sck pin high or low. This delay could be required for faster MCUs.
+#define HX711_SETTLING_FAST_MS 50           // settling time after switching to 80 sps
+#define HX711_SETTLING_SLOW_MS 400          // settling time after switching to 10 sps
 ;                                           //
 #define MDM_HALL 0                          // use built-in hall sensor to detect crank revolutions
 #define MDM_MPU 1                           // use MPU to detect crank revolutions
 #define MDM_STRAIN 2                        // use strain gauge to detect crank revolutions
-#define MDM_MAX 3                           // marks the high limit
+#define MDM_MPU_GYRO 3                      // use MPU gyro rate integrated into a continuous crank angle
+#define MDM_FUSED 4                         // strain threshold crossings cross-validated with the MPU gyro crank angle
+#define MDM_MAX 5                           // marks the high limit
 #define MOTION_DETECTION_METHOD MDM_STRAIN  // method of detecting crank revolutions
 #define MDM_STRAIN_DEFAULT_THRESHOLD 10     // strain motion detection default high threshold
 #define MDM_STRAIN_DEFAULT_THRES_LOW 2      // strain motion detection default low threshold
@@ -62,7 +103,7 @@
 #define HALL_DEFAULT_THRESHOLD 10           // hall effect sensor default high threshold
 #define HALL_DEFAULT_THRES_LOW 2            // hall effect sensor default low threshold
 #define HALL_DEFAULT_OFFSET -100            // hall effect sensor default calibration offset
-#define HALL_DEFAULT_SAMPLES 10             // # of samples for hall measurement averaging
+#define HALL_DEFAULT_SAMPLES 4              // # of readings in the running average, one per motion tick
 ;                                           //
 #define NTM_KEEP 0                          // include negative torque readings in the power calculation
 #define NTM_ZERO 1                          // convert negative torque readings to zero
@@ -73,6 +114,12 @@
 ;                                           //
 #define CRANK_EVENT_MIN_MS 400              // 400 ms = 150 RPM
 ;                                           //
+#define CADENCE_ALPHA 0.5f                  // cadence tracker phase gain
+#define CADENCE_BETA 0.2f                   // cadence tracker period gain
+#define CADENCE_TOLERANCE 0.25f             // cadence tracker outlier tolerance, fraction of the predicted period
+#define CADENCE_TIMEOUT_MS 3000             // restart cadence tracking after this long without crank events (3s = 20RPM)
+#define CADENCE_MAX_STREAK 3                // re-seed the predicted period after this many consecutive outliers
+;                                           //
 #define POWER_ZERO_DELAY_MS 3000            // push zero power values after the last crank event (3s = 20RPM)
 ;                                           //
 #define AUTO_TARE 1                         // enable auto tare by default
@@ -85,6 +132,12 @@
 #define WM_MAX 3                            // marks the high limit
 #define WM_CHAR_MODE WM_WHEN_NO_CRANK       //
 ;                                           //
+#define CHAR_USER_DESC_UUID "2901"          // characteristic user description descriptor
+#define CPS_CONTROL_POINT_CHAR_UUID "2a66"  // cycling power control point
+#define PEDAL_METRICS_CHAR_UUID "a3e1c0de-0001-4c6f-9a2b-45535030d001"  // torque effectiveness and pedal smoothness
+#define STRAIN_STREAM_CHAR_UUID "a3e1c0de-0002-4c6f-9a2b-45535030d001"  // packed strain samples, see strain_stream.h
+#define BINARY_API_CHAR_UUID "a3e1c0de-0003-4c6f-9a2b-45535030d001"     // binary framed api, see binary_api.h
+;                                           //
 
 #include "atoll_ble_constants.h"
 
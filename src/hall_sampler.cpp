@@ -0,0 +1,68 @@
+#include "hall_sampler.h"
+
+#ifdef ARDUINO
+static int hallSamplerDefaultSource() {
+    return hall_sensor_read();
+}
+#endif
+
+// Starts sampling, values are the average of the last `window` readings.
+// Without a source, readings come from the built-in hall sensor, or on host
+// builds only from feed().
+bool HallSampler::begin(uint8_t window, Source source) {
+    if (0 == window) window = 1;
+    if (HALL_SAMPLER_WINDOW_MAX < window) window = HALL_SAMPLER_WINDOW_MAX;
+    _window = window;
+    _sum = 0;
+    _next = 0;
+    _count = 0;
+    _available = false;
+#ifdef ARDUINO
+    _source = nullptr != source ? source : hallSamplerDefaultSource;
+#else
+    _source = source;
+#endif
+    _running = true;
+    return true;
+}
+
+void HallSampler::end() {
+    _running = false;
+}
+
+bool HallSampler::running() {
+    return _running;
+}
+
+// Takes one reading from the source.
+void HallSampler::sample() {
+    if (!_running || nullptr == _source) return;
+    feed(_source());
+}
+
+// Adds a raw reading to the window, O(1): the oldest reading leaves the
+// integer sum, which is divided once with rounding.
+void HallSampler::feed(int raw) {
+    if (_count < _window)
+        _count++;
+    else
+        _sum -= _readings[_next];
+    _readings[_next] = raw;
+    _sum += raw;
+    _next = (_next + 1) % _window;
+    if (_count < _window) return;
+    int32_t half = _window / 2;
+    _value = (int)((0 <= _sum ? _sum + half : _sum - half) / _window);
+    _available = true;
+}
+
+// True if a value was published since the last read().
+bool HallSampler::available() {
+    return _available;
+}
+
+// Returns the latest averaged value.
+int HallSampler::read() {
+    _available = false;
+    return _value;
+}
@@ -0,0 +1,45 @@
+#ifndef HALL_SAMPLER_H
+#define HALL_SAMPLER_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif
+
+#ifndef HALL_SAMPLER_WINDOW_MAX
+#define HALL_SAMPLER_WINDOW_MAX 16  // maximum number of readings averaged
+#endif
+
+// Acquisition of the built-in hall sensor.
+// sample() takes a single reading per motion tick, feed() keeps the last
+// `window` readings and publishes their rounded running average once the
+// window is full, so a value is available every tick without a burst of
+// conversions.
+// On host builds there is no default source, raw samples are pushed through feed().
+class HallSampler {
+   public:
+    typedef int (*Source)();
+
+    bool begin(uint8_t window, Source source = nullptr);
+    void end();
+    bool running();
+    void sample();
+    void feed(int raw);
+    bool available();
+    int read();
+
+   protected:
+    Source _source = nullptr;
+    uint8_t _window = 1;
+    int32_t _readings[HALL_SAMPLER_WINDOW_MAX];
+    int32_t _sum = 0;
+    uint8_t _next = 0;   // index of the oldest reading
+    uint8_t _count = 0;  // readings in the window
+    int _value = 0;
+    bool _available = false;
+    bool _running = false;
+};
+
+#endif
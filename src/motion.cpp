@@ -3,6 +3,34 @@
 
 #include "driver/adc.h"
 
+#ifdef FEATURE_MPU
+// MPU register map, prefixed to stay clear of the MPU9250 library
+#define MPU_REG_SMPLRT_DIV 0x19
+#define MPU_REG_CONFIG 0x1A
+#define MPU_REG_ACCEL_CONFIG2 0x1D
+#define MPU_REG_FIFO_EN 0x23
+#define MPU_REG_INT_STATUS 0x3A
+#define MPU_REG_USER_CTRL 0x6A
+#define MPU_REG_FIFO_COUNTH 0x72
+#define MPU_REG_FIFO_R_W 0x74
+#define MPU_FIFO_EN_TEMP_GYRO_ACCEL 0xF8  // temp, gyro x, y, z, accel
+#define MPU_USER_CTRL_FIFO_EN 0x40
+#define MPU_USER_CTRL_FIFO_RST 0x04
+#define MPU_INT_STATUS_FIFO_OFLOW 0x10
+
+// Sample rate and low pass filter profiles from idle to high cadence.
+static const struct {
+    uint8_t divider;  // sample rate = 1 kHz / (1 + divider)
+    uint8_t dlpf;     // gyro DLPF_CFG and accel A_DLPF_CFG
+    float upRpm;      // cadence to move up to the next profile
+} mpuRateProfiles[MPU_RATE_PROFILES] = {
+    {39, 5, 0.0f},    // 25 Hz, 10 Hz bandwidth, not moving
+    {15, 4, 70.0f},   // 62.5 Hz, 20 Hz
+    {7, 3, 120.0f},   // 125 Hz, 41 Hz, same as the library setup
+    {3, 2, 0.0f},     // 250 Hz, 92 Hz
+};
+#endif
+
 #ifdef FEATURE_MPU
 void Motion::setup(const uint8_t sdaPin,
                    const uint8_t sclPin,
@@ -15,7 +43,8 @@ void Motion::setup(const uint8_t sdaPin,
                    const char *preferencesNS,
                    uint8_t mpuAddress) {
     preferencesSetup(p, preferencesNS);
-    if (board.motionDetectionMethod == MDM_MPU ||
+    _mpuAddress = mpuAddress;
+    if (board.mdmUsesMpu() ||
 #ifdef FEATURE_MPU_TEMPERATURE
         true
 #else
@@ -23,10 +52,10 @@ void Motion::setup(const uint8_t sdaPin,
 #endif
     ) {
         Wire.begin(sdaPin, sclPin);
-        vTaskDelay(100);
+        vTaskDelay(board.fastWake ? 10 : 100);  // the MPU stayed powered in wake-on-motion
         mpu = new MPU9250();
         // device->verbose(true);
-        MPU9250Setting s;
+        MPU9250Setting &s = _mpuSetting;
         s.skip_mag = true;  // compass not needed
         s.fifo_sample_rate = FIFO_SAMPLE_RATE::SMPL_125HZ;
         // s.gyro_dlpf_cfg = GYRO_DLPF_CFG::DLPF_10HZ;
@@ -44,144 +73,421 @@ void Motion::setup(const uint8_t sdaPin,
 #else   // !FEATURE_MPU
 void Motion::setup(::Preferences *pp, const char *preferencesNS) {
     preferencesSetup(p, preferencesNS);
-    if (board.motionDetectionMethod == MDM_MPU) log_e("MDM is MPU but FEATURE_MPU is missing");
+    if (board.mdmUsesMpu()) log_e("MDM is MPU but FEATURE_MPU is missing");
 #endif  // FEATURE_MPU
 
-    if (board.motionDetectionMethod == MDM_HALL) {
-        adc1_config_width(ADC_WIDTH_BIT_12);
-    }
+    if (board.motionDetectionMethod == MDM_HALL) _hallSetup();
     loadSettings();
+#ifdef FEATURE_MPU
+    if (mpuFifo && board.mdmUsesMpu()) _mpuFifoSetup();
+#endif
     // printSettings();
+    selectPipeline();
     updateEnabled = true;
     lastMovement = millis();
 }
 
+#ifdef FEATURE_MPU
+// MPU detector policies, each handles a polled or a FIFO sample.
+// MDM_MPU: crossings of the fused or gyro-integrated yaw.
+struct Motion::MpuYawDetector {
+    static void onPolled(Motion &m, const ulong t) {
+        m._onMpuAngle(m.mpu->getYaw() + 180.0, t);  // -180...180 -> 0...360
+    }
+    static void onFifo(Motion &m, int16_t ax, int16_t ay, int16_t gz, const float dt, const ulong t) {
+        m._fifoYaw += gz / MPU_GYRO_LSB_PER_DPS * dt;
+        if (180.0 < m._fifoYaw)
+            m._fifoYaw -= 360.0;
+        else if (m._fifoYaw < -180.0)
+            m._fifoYaw += 360.0;
+        m._onMpuAngle(m._fifoYaw + 180.0, t);
+    }
+};
+
+// MDM_MPU_GYRO: continuous crank angle from the gyro rate.
+struct Motion::MpuGyroDetector {
+    static void onPolled(Motion &m, const ulong t) {
+        const ulong us = micros();
+        const float dt = 0 < m._lastGyroUs ? (us - m._lastGyroUs) / 1000000.0 : 0.0;
+        m._lastGyroUs = us;
+        m._onMpuGyro(m.mpu->getGyroZ(), m.mpu->getAccX(), m.mpu->getAccY(), dt, t);
+    }
+    static void onFifo(Motion &m, int16_t ax, int16_t ay, int16_t gz, const float dt, const ulong t) {
+        // accel scale is irrelevant, only the direction of gravity is used
+        m._onMpuGyro(gz / MPU_GYRO_LSB_PER_DPS, ax, ay, dt, t);
+    }
+};
+
+// MDM_FUSED: the crank angle only, crank events are decided in the strain task.
+struct Motion::MpuFusedDetector {
+    static void onPolled(Motion &m, const ulong t) {
+        const ulong us = micros();
+        const float dt = 0 < m._lastGyroUs ? (us - m._lastGyroUs) / 1000000.0 : 0.0;
+        m._lastGyroUs = us;
+        m._onMpuGyro(m.mpu->getGyroZ(), m.mpu->getAccX(), m.mpu->getAccY(), dt, t, false);
+    }
+    static void onFifo(Motion &m, int16_t ax, int16_t ay, int16_t gz, const float dt, const ulong t) {
+        m._onMpuGyro(gz / MPU_GYRO_LSB_PER_DPS, ax, ay, dt, t, false);
+    }
+};
+#endif  // FEATURE_MPU
+
+// Selects the pipeline for the current detection method and settings, so the
+// loop itself does not branch on them. Called before the task is started.
+void Motion::selectPipeline() {
+    if (board.motionDetectionMethod != MDM_HALL && hallSampler.running())
+        hallSampler.end();
+    _pipeline = &Motion::_noDetectionLoop;
+    if (board.motionDetectionMethod == MDM_HALL)
+        _pipeline = &Motion::_hallLoop;
+#ifdef FEATURE_MPU
+    else if (board.motionDetectionMethod == MDM_MPU)
+        _pipeline = mpuFifo ? &Motion::_mpuFifoLoop<MpuYawDetector> : &Motion::_mpuLoop<MpuYawDetector>;
+    else if (board.motionDetectionMethod == MDM_MPU_GYRO)
+        _pipeline = mpuFifo ? &Motion::_mpuFifoLoop<MpuGyroDetector> : &Motion::_mpuLoop<MpuGyroDetector>;
+    else if (board.motionDetectionMethod == MDM_FUSED)
+        _pipeline = mpuFifo ? &Motion::_mpuFifoLoop<MpuFusedDetector> : &Motion::_mpuLoop<MpuFusedDetector>;
+#endif
+}
+
 void Motion::loop() {
-    const ulong t = millis();
+    _sampleUs = Timebase::us();
+    (this->*_pipeline)(Timebase::toMillis(_sampleUs));
+}
+
+// The motion task runs without crank detection, e.g. for the MPU temperature.
+void Motion::_noDetectionLoop(const ulong t) {
+#if defined(FEATURE_MPU) && defined(FEATURE_MPU_TEMPERATURE)
+    mpu->update();
+#endif
+}
+
+void Motion::_hallLoop(const ulong t) {
+    if (!hallSampler.running()) _hallSetup();
+    hallSampler.sample();
+    if (!hallSampler.available()) return;
+    if (_hallDetector.update(abs(hall()), hallThresLow, hallThreshold))
+        onCrankEvent(t, _sampleUs);
+}
 
 #ifdef FEATURE_MPU
-    if (board.motionDetectionMethod == MDM_MPU) {
-        if (mpuAccelGyroNeedsCalibration) {
-            mpuCalibrateAccelGyro();
-            mpuAccelGyroNeedsCalibration = false;
-        }
-        if (mpuMagNeedsCalibration) {
-            mpuCalibrateMag();
-            mpuMagNeedsCalibration = false;
-        }
-        if (!updateEnabled)
-            return;
-        if (!mpu->update())
-            return;
+// Handles pending calibrations, returns false if there should be no update.
+bool Motion::_mpuPrepare() {
+    if (mpuAccelGyroNeedsCalibration) {
+        mpuCalibrateAccelGyro();
+        mpuAccelGyroNeedsCalibration = false;
+    }
+    if (mpuMagNeedsCalibration) {
+        mpuCalibrateMag();
+        mpuMagNeedsCalibration = false;
+    }
+    if (mpuNeedsReconfiguration) {
+        if (!mpuAdaptiveRate) _mpuSetProfile(MPU_RATE_PROFILE_DEFAULT);
+        _mpuFifoSetup();  // also stops the FIFO when it was switched off
+        mpuNeedsReconfiguration = false;
+    }
+    return updateEnabled;
+}
+
+template <class Detector>
+void Motion::_mpuLoop(const ulong t) {
+    if (!_mpuPrepare()) return;
+    if (!mpu->update()) return;
 
 #ifdef FEATURE_SERIAL
-        if (0 < mpuLogMs && _mpuLastLogMs + mpuLogMs <= t) {
-            Serial.printf("[MPU] %.2f %.2f %.2f %.2f\n",
-                          mpu->getPitch(),
-                          mpu->getRoll(),
-                          mpu->getYaw(),
-                          mpu->getTemperature());
-            _mpuLastLogMs = t;
-        }
+    if (0 < mpuLogMs && _mpuLastLogMs + mpuLogMs <= t) {
+        Serial.printf("[MPU] %.2f %.2f %.2f %.2f\n",
+                      mpu->getPitch(),
+                      mpu->getRoll(),
+                      mpu->getYaw(),
+                      mpu->getTemperature());
+        _mpuLastLogMs = t;
+    }
 #endif  // FEATURE_SERIAL
 
-        float angle = mpu->getYaw() + 180.0;  // -180...180 -> 0...360
-
-        if ((_previousAngle < 180.0 && 180.0 <= angle) || (angle < 180.0 && 180.0 <= _previousAngle)) {
-            lastMovement = t;
-            if (!_halfRevolution) {
-                if (0 < lastCrankEventTime) {
-                    ulong dt = t - lastCrankEventTime;
-                    if (CRANK_EVENT_MIN_MS < dt) {
-                        revolutions++;
-                        log_i("crank event #%d dt: %ldms", revolutions, dt);
-                        board.power.onCrankEvent(dt);
-                        board.bleServer.onCrankEvent(t, revolutions);
-                    } else {
-                        // Serial.printf("Crank event skip, dt too small: %ldms\n", dt);
-                    }
-                }
-                lastCrankEventTime = t;
-            }
-            _halfRevolution = !_halfRevolution;
-        }
-        _previousTime = t;
-        _previousAngle = angle;
-    } else
+    Detector::onPolled(*this, t);
+    if (mpuAdaptiveRate && _mpuLastAdapt + 1000 <= t) _mpuAdaptRate(t);
+}
+#endif  // FEATURE_MPU
 
-#ifdef FEATURE_MPU_TEMPERATURE
-        mpu->update();
-#endif  // FEATURE_MPU_TEMPERATURE
+void Motion::_hallSetup() {
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    hallSampler.begin(HALL_DEFAULT_SAMPLES);
+}
 
-#endif  // FEATURE_MPU
+#ifdef FEATURE_MPU
+// Detects crank events from the yaw angle (0...360) of a sample taken at time t.
+void Motion::_onMpuAngle(const float angle, const ulong t) {
+    if ((_previousAngle < 180.0 && 180.0 <= angle) || (angle < 180.0 && 180.0 <= _previousAngle)) {
+        lastMovement = t;
+        if (!_halfRevolution) onCrankEvent(t, _sampleUs);
+        _halfRevolution = !_halfRevolution;
+    }
+    _previousTime = t;
+    _previousAngle = angle;
+}
 
-    if (board.motionDetectionMethod == MDM_HALL) {
-        if (!_halfRevolution) {
-            if (abs(hall()) < hallThresLow) {
-                _halfRevolution = true;
+// Integrates the crank axis gyro rate (deg/s) of a sample taken at time t,
+// dt seconds after the previous one, into the continuous crank angle.
+// Crossing 0° produces a crank event with a timestamp interpolated between the
+// samples. On each event the angle is pulled towards the direction of gravity,
+// taken from the accelerometer with the mean of the last revolution (the
+// centripetal component) removed. Without crankEvents only the angle is tracked.
+void Motion::_onMpuGyro(const float rateDps, const float ax, const float ay, const float dt, const ulong t, const bool crankEvents) {
+    const float rate = board.power.reverseMPU ? -rateDps : rateDps;
+    _crankRate = rate;
+    _crankAngleTime = t;
+    _accSumX += ax;
+    _accSumY += ay;
+    _accSamples++;
+    float angle = _crankAngle + rate * dt;
+    if (angle < 0.0)
+        angle += 360.0;
+    else if (360.0 <= angle) {
+        angle -= 360.0;
+        if (MPU_GYRO_MIN_DPS <= rate) {
+            const int64_t usEvent = _sampleUs - (int64_t)(angle / rate * 1000000.0);
+            // the mean of a partial revolution, e.g. after a pause, is not the
+            // offset of the accelerometer
+            if (MPU_GRAVITY_MIN_SAMPLES <= _accSamples) {
+                _accMeanX = _accSumX / _accSamples;
+                _accMeanY = _accSumY / _accSamples;
+                float gravityAngle = atan2(ay - _accMeanY, ax - _accMeanX) * RAD_TO_DEG;
+                if (!board.power.reverseMPU) gravityAngle = -gravityAngle;
+                float error = gravityAngle - angle;
+                while (180.0 < error) error -= 360.0;
+                while (error < -180.0) error += 360.0;
+                angle += MPU_GRAVITY_CORRECTION * error;
+                // the event has been sent, moving back across 0 would wrap
+                // the angle to ~360 and send another one
+                if (angle < 0.0) angle = 0.0;
             }
-        } else if (hallThreshold < abs(hall())) {
-            _halfRevolution = false;
-            lastMovement = t;
-            if (0 < lastCrankEventTime) {
-                ulong dt = t - lastCrankEventTime;
-                if (CRANK_EVENT_MIN_MS < dt) {
-                    revolutions++;
-                    log_i("crank event #%d dt: %ldms", revolutions, dt);
-                    board.power.onCrankEvent(dt);
-                    board.bleServer.onCrankEvent(t, revolutions);
-                    lastCrankEventTime = t;
-                } else {
-                    // Serial.printf("Crank event skip, dt too small: %ldms\n", dt);
-                }
-            } else {
-                lastCrankEventTime = t;
+            _accSumX = 0.0;
+            _accSumY = 0.0;
+            _accSamples = 0;
+            if (crankEvents) {
+                lastMovement = t;
+                onCrankEvent(Timebase::toMillis(usEvent), usEvent);
             }
         }
     }
+    _crankAngle = angle;
 }
 
-int Motion::hall() {
-    float avg = 0.0;
-    for (int i = 0; i < HALL_DEFAULT_SAMPLES; i++) {
-        avg += hall_sensor_read() / HALL_DEFAULT_SAMPLES;
-        delayMicroseconds(3);
+// Returns the crank angle (0...360) extrapolated to time t.
+float Motion::crankAngle(ulong t) {
+    if (0 == t) t = millis();
+    float angle = _crankAngle + _crankRate * (long)(t - _crankAngleTime) / 1000.0;
+    angle = fmod(angle, 360.0);
+    if (angle < 0.0) angle += 360.0;
+    return angle;
+}
+
+// Returns the instantaneous cadence from the gyro rate.
+float Motion::crankRpm() {
+    return _crankRate / 6.0;
+}
+
+// Routes accel, temperature and gyro samples into the FIFO and resets it.
+void Motion::_mpuFifoSetup() {
+    _mpuWrite(MPU_REG_USER_CTRL, 0x00);
+    _mpuWrite(MPU_REG_FIFO_EN, mpuFifo ? MPU_FIFO_EN_TEMP_GYRO_ACCEL : 0x00);
+    _mpuWrite(MPU_REG_USER_CTRL, MPU_USER_CTRL_FIFO_RST);
+    if (mpuFifo) _mpuWrite(MPU_REG_USER_CTRL, MPU_USER_CTRL_FIFO_EN);
+    _fifoYaw = 0.0;
+}
+
+// Drains all queued samples in I2C bursts and processes them with timestamps
+// reconstructed from the FIFO rate, the newest sample being taken at time t.
+template <class Detector>
+void Motion::_mpuFifoLoop(const ulong t) {
+    if (!_mpuPrepare()) return;
+    uint8_t buf[MPU_FIFO_BURST_SAMPLES * MPU_FIFO_SAMPLE_SIZE];
+    if (!_mpuRead(MPU_REG_INT_STATUS, buf, 1)) return;
+    if (buf[0] & MPU_INT_STATUS_FIFO_OFLOW) {
+        log_e("FIFO overflow");
+        _mpuFifoSetup();
+        return;
+    }
+    if (!_mpuRead(MPU_REG_FIFO_COUNTH, buf, 2)) return;
+    uint16_t queued = (((uint16_t)buf[0] << 8) | buf[1]) / MPU_FIFO_SAMPLE_SIZE;
+    uint16_t remaining = queued;
+    const float dt = _mpuSampleUs / 1000000.0;
+    const int64_t newestUs = _sampleUs;
+    while (0 < remaining) {
+        uint8_t n = remaining < MPU_FIFO_BURST_SAMPLES ? remaining : MPU_FIFO_BURST_SAMPLES;
+        if (!_mpuRead(MPU_REG_FIFO_R_W, buf, n * MPU_FIFO_SAMPLE_SIZE)) return;
+        for (uint8_t i = 0; i < n; i++) {
+            uint8_t *sample = &buf[i * MPU_FIFO_SAMPLE_SIZE];
+            int16_t ax = (int16_t)((sample[0] << 8) | sample[1]);
+            int16_t ay = (int16_t)((sample[2] << 8) | sample[3]);
+            int16_t temp = (int16_t)((sample[6] << 8) | sample[7]);
+            int16_t gz = (int16_t)((sample[12] << 8) | sample[13]);
+            _fifoTemperature = temp / 333.87 + 21.0;
+            remaining--;
+            _sampleUs = newestUs - (int64_t)remaining * _mpuSampleUs;
+            Detector::onFifo(*this, ax, ay, gz, dt, Timebase::toMillis(_sampleUs));
+        }
+    }
+    // the FIFO is empty, the rate can change without mixing sample periods
+    if (mpuAdaptiveRate && _mpuLastAdapt + 1000 <= t) _mpuAdaptRate(t);
+#ifdef FEATURE_SERIAL
+    if (0 < mpuLogMs && _mpuLastLogMs + mpuLogMs <= t) {
+        Serial.printf("[MPU] FIFO %d %.2f %.2f\n", queued, _fifoYaw, _fifoTemperature);
+        _mpuLastLogMs = t;
+    }
+#endif  // FEATURE_SERIAL
+}
+
+// Moves one profile up or down depending on the cadence, or to the lowest
+// profile when not moving. Called once per second with the FIFO drained.
+void Motion::_mpuAdaptRate(const ulong t) {
+    _mpuLastAdapt = t;
+    uint8_t profile = 0;
+    if (t - lastMovement < MPU_RATE_IDLE_MS) {
+        float rpm = board.cadence.rpm(t);
+        profile = _mpuProfile < 1 ? 1 : _mpuProfile;
+        if (profile + 1 < MPU_RATE_PROFILES && mpuRateProfiles[profile].upRpm <= rpm)
+            profile++;
+        else if (1 < profile && rpm < mpuRateProfiles[profile - 1].upRpm * MPU_RATE_HYSTERESIS)
+            profile--;
+    }
+    if (profile != _mpuProfile) _mpuSetProfile(profile);
+}
+
+// Writes the sample rate divider and the filter configuration of the profile.
+void Motion::_mpuSetProfile(const uint8_t profile) {
+    if (MPU_RATE_PROFILES <= profile) return;
+    const uint8_t dlpf = mpuRateProfiles[profile].dlpf;
+    if (!_mpuWrite(MPU_REG_SMPLRT_DIV, mpuRateProfiles[profile].divider)) return;
+    _mpuWrite(MPU_REG_CONFIG, dlpf);          // FIFO_MODE and EXT_SYNC_SET cleared
+    _mpuWrite(MPU_REG_ACCEL_CONFIG2, dlpf);   // ACCEL_FCHOICE_B cleared: DLPF enabled
+    _mpuProfile = profile;
+    _mpuSampleUs = 1000UL * (1 + mpuRateProfiles[profile].divider);
+    // polled at the sample rate, unless the FIFO is drained or the strain task polls the MPU
+    if (!mpuFifo && board.mdmUsesMotionTask()) board.setTaskFreq("motion", 1000000.0f / _mpuSampleUs);
+    log_d("profile %d, %.1f Hz", profile, 1000000.0f / _mpuSampleUs);
+}
+
+void Motion::setMpuAdaptiveRate(bool enabled) {
+    mpuAdaptiveRate = enabled;
+    saveSettings();
+    // the MPU is only accessed from the task polling it
+    if (!enabled && MPU_RATE_PROFILE_DEFAULT != _mpuProfile && board.mdmUsesMpu())
+        mpuNeedsReconfiguration = true;
+}
+
+bool Motion::_mpuWrite(uint8_t reg, uint8_t value) {
+    Wire.beginTransmission(_mpuAddress);
+    Wire.write(reg);
+    Wire.write(value);
+    uint8_t err = Wire.endTransmission();
+    if (err) log_e("write error %d reg 0x%02x", err, reg);
+    return 0 == err;
+}
+
+bool Motion::_mpuRead(uint8_t reg, uint8_t *buf, uint8_t len) {
+    Wire.beginTransmission(_mpuAddress);
+    Wire.write(reg);
+    uint8_t err = Wire.endTransmission(false);
+    if (err) {
+        log_e("read error %d reg 0x%02x", err, reg);
+        return false;
     }
-    /*
-    int value;
-    Serial.print("hall() ");
-    for (int i = 0; i < HALL_DEFAULT_SAMPLES; i++) {
-        value = hall_sensor_read();
-        avg += value / HALL_DEFAULT_SAMPLES;
-        Serial.printf("%d ", value + hallOffset);
+    if (len != Wire.requestFrom(_mpuAddress, len)) {
+        log_e("short read reg 0x%02x", reg);
+        return false;
     }
-    Serial.println();
-    */
-    lastHallValue = (int)avg + hallOffset;
+    for (uint8_t i = 0; i < len; i++) buf[i] = Wire.read();
+    return true;
+}
+
+void Motion::setMpuFifo(bool enabled) {
+    if (enabled == mpuFifo) return;
+    mpuFifo = enabled;
+    saveSettings();
+    if (!board.mdmUsesMpu()) return;
+    // the MPU is only accessed from the task polling it, the restarted
+    // pipeline sets up the FIFO before its first read
+    mpuNeedsReconfiguration = true;
+    board.restartTask("motion");
+}
+#endif  // FEATURE_MPU
+
+// Returns the task frequency for the current motion detection method and settings.
+float Motion::taskFreq() {
+    if (board.motionDetectionMethod == MDM_HALL) return MOTION_TASK_FREQ;
+#ifdef FEATURE_MPU
+    if (board.mdmUsesMpu()) return mpuFifo ? MOTION_FIFO_TASK_FREQ : 1000000.0f / _mpuSampleUs;
+#ifdef FEATURE_MPU_TEMPERATURE
+    return MPU_TEMP_TASK_FREQ;
+#endif
+#endif
+    return -1.0f;
+}
+
+// Common bookkeeping of a crank event detected at time t, the cadence tracker
+// decides how many revolutions it represents and the time per revolution.
+void Motion::onCrankEvent(const ulong t, int64_t us) {
+    lastMovement = t;
+    if (us < 0) us = Timebase::fromMillis(t);
+    Cadence::Event e = board.cadence.onEvent(t, us);
+    lastCrankEventTime = board.cadence.lastEventTime;
+    if (e.restarted) board.power.resetRevolution();
+    if (0 == e.revolutions) return;
+    revolutions += e.revolutions;
+    log_i("crank event #%d dt: %.1fms", revolutions, e.dtUs / 1000.0f);
+    board.power.onCrankEvent(e.dtUs);
+    board.bleServer.onCrankEvent(us, revolutions);
+}
+
+// Returns the latest averaged hall reading from the sampler.
+int Motion::hall() {
+    lastHallValue = hallSampler.read() + hallOffset;
     return lastHallValue;
 }
 
 #ifdef FEATURE_MPU
-// Enable wake-on-motion and go to sleep
+// Enable wake-on-motion and go to sleep. The MPU is also armed when it is not
+// the motion detection method, e.g. as the wake source of the idle mode.
 void Motion::mpuEnableWomSleep(void) {
     // Todo enable waking on hall sensor (https://esp32.com/viewtopic.php?t=4608)
-    if (board.motionDetectionMethod != MDM_MPU) return;
+    if (nullptr == mpu) return;
     log_i("Enabling W-O-M sleep");
     updateEnabled = false;
     delay(20);
     mpu->enableWomSleep();
 }
 
+// Brings the MPU back from wake-on-motion, the biases are written again.
+void Motion::mpuWake() {
+    if (!mpu->setup(_mpuAddress, _mpuSetting))
+        log_e("setup error");
+    mpu->setAccBias(mpu->getAccBiasX(), mpu->getAccBiasY(), mpu->getAccBiasZ());
+    mpu->setGyroBias(mpu->getGyroBiasX(), mpu->getGyroBiasY(), mpu->getGyroBiasZ());
+    _mpuSetProfile(_mpuProfile);
+    if (mpuFifo && board.mdmUsesMpu()) _mpuFifoSetup();
+    updateEnabled = true;
+}
+
+// Reading the interrupt status clears the latched wake-on-motion interrupt.
+void Motion::mpuClearWom() {
+    uint8_t status;
+    _mpuRead(MPU_REG_INT_STATUS, &status, 1);
+}
+
 void Motion::mpuCalibrateAccelGyro() {
-    if (board.motionDetectionMethod != MDM_MPU) return;
+    if (!board.mdmUsesMpu()) return;
     log_i("Accel and Gyro calibration, please leave the device still.");
     updateEnabled = false;
     mpu->calibrateAccelGyro();
+    _mpuSetProfile(_mpuProfile);   // calibration reconfigures the rate
+    if (mpuFifo) _mpuFifoSetup();  // and the FIFO
     updateEnabled = true;
 }
 
 void Motion::mpuCalibrateMag() {
-    if (board.motionDetectionMethod != MDM_MPU) return;
+    if (!board.mdmUsesMpu()) return;
     log_i("Mag calibration, please wave device in a figure eight for 15 seconds.");
     updateEnabled = false;
     mpu->calibrateMag();
@@ -190,13 +496,15 @@ void Motion::mpuCalibrateMag() {
 
 void Motion::mpuCalibrate() {
     mpu->calibrateAccelGyro();
+    _mpuSetProfile(_mpuProfile);
+    if (mpuFifo) _mpuFifoSetup();
     mpu->calibrateMag();
     printSettings();
     saveSettings();
 }
 
 void Motion::printMpuAccelGyroCalibration() {
-    if (board.motionDetectionMethod != MDM_MPU) return;
+    if (!board.mdmUsesMpu()) return;
     log_i("%16s ---------X--------------Y--------------Z------\n", preferencesNS);
     log_i("Accel bias [g]:    %14f %14f %14f",
           mpu->getAccBiasX() * 1000.f / (float)MPU9250::CALIB_ACCEL_SENSITIVITY,
@@ -210,7 +518,7 @@ void Motion::printMpuAccelGyroCalibration() {
 }
 
 void Motion::printMpuMagCalibration() {
-    if (board.motionDetectionMethod != MDM_MPU) return;
+    if (!board.mdmUsesMpu()) return;
     log_i("%16s ---------X--------------Y--------------Z------", preferencesNS);
     log_i("Mag bias [mG]:     %14f %14f %14f",
           mpu->getMagBiasX(),
@@ -247,6 +555,10 @@ void Motion::printSettings() {
         log_i("Strain");
     else if (board.motionDetectionMethod == MDM_MPU)
         log_i("MPU");
+    else if (board.motionDetectionMethod == MDM_MPU_GYRO)
+        log_i("MPU gyro");
+    else if (board.motionDetectionMethod == MDM_FUSED)
+        log_i("Strain + MPU gyro");
     else if (board.motionDetectionMethod == MDM_HALL)
         log_i("Hall sensor");
     else
@@ -266,7 +578,7 @@ void Motion::printMDCalibration() {
 void Motion::loadSettings() {
     if (!preferencesStartLoad()) return;
 
-    if (board.motionDetectionMethod == MDM_MPU) {
+    if (board.mdmUsesMpu()) {
 #ifdef FEATURE_MPU
         if (!preferences->getBool("mpuCal", false)) {
             preferencesEnd();
@@ -293,6 +605,10 @@ void Motion::loadSettings() {
         log_e("MDM is MPU but FEATURE_MPU is missing");
 #endif
     }
+#ifdef FEATURE_MPU
+    mpuFifo = preferences->getBool("mpuFifo", mpuFifo);
+    mpuAdaptiveRate = preferences->getBool("mpuAdapt", mpuAdaptiveRate);
+#endif
     hallOffset = preferences->getInt("hallO", hallOffset);
     hallThreshold = preferences->getInt("hallT", hallThreshold);
     hallThresLow = preferences->getInt("hallTL", hallThresLow);
@@ -303,7 +619,7 @@ void Motion::loadSettings() {
 void Motion::saveSettings() {
     if (!preferencesStartSave()) return;
 #ifdef FEATURE_MPU
-    if (board.motionDetectionMethod == MDM_MPU) {
+    if (board.mdmUsesMpu()) {
         _prefPutValidFloat("mpuabX", mpu->getAccBiasX());
         _prefPutValidFloat("mpuabY", mpu->getAccBiasY());
         _prefPutValidFloat("mpuabZ", mpu->getAccBiasZ());
@@ -318,6 +634,10 @@ void Motion::saveSettings() {
         _prefPutValidFloat("mpumsZ", mpu->getMagScaleZ());
         preferences->putBool("mpuCal", true);
     }
+#endif
+#ifdef FEATURE_MPU
+    preferences->putBool("mpuFifo", mpuFifo);
+    preferences->putBool("mpuAdapt", mpuAdaptiveRate);
 #endif
     preferences->putInt("hallO", (int32_t)hallOffset);
     preferences->putInt("hallT", (int32_t)hallThreshold);
@@ -348,6 +668,7 @@ size_t Motion::_prefPutValidFloat(const char *key, const float_t value) {
 
 #if defined(FEATURE_MPU) && defined(FEATURE_MPU_TEMPERATURE)
 float Motion::getMpuTemperature() {
+    if (mpuFifo && board.mdmUsesMpu()) return _fifoTemperature;
     return mpu->getTemperature();
 }
 #endif
\ No newline at end of file
@@ -9,11 +9,22 @@
 #ifndef MPU_RINGBUF_SIZE
 #define MPU_RINGBUF_SIZE 16  // circular buffer size
 #endif
+#ifndef MPU_FIFO_SAMPLE_US
+#define MPU_FIFO_SAMPLE_US 8000  // FIFO sample period @ 125 sps
+#endif
+#define MPU_RATE_PROFILES 4         // number of sample rate and filter profiles
+#define MPU_RATE_PROFILE_DEFAULT 2  // 125 sps, set up by the library
+#define MPU_FIFO_SAMPLE_SIZE 14    // bytes per FIFO sample: accel xyz, temp, gyro xyz
+#define MPU_FIFO_BURST_SAMPLES 9   // samples per I2C burst, 9 * 14 bytes fit in the Wire buffer
+#define MPU_GYRO_LSB_PER_DPS 16.4f  // gyro sensitivity @ 2000 dps full scale
 #endif
 #include <Preferences.h>
 
 #include "atoll_preferences.h"
 #include "atoll_task.h"
+#include "crank_detector.h"
+#include "hall_sampler.h"
+#include "timebase.h"
 
 class Motion : public Atoll::Task, public Atoll::Preferences {
    public:
@@ -23,6 +34,9 @@ class Motion : public Atoll::Task, public Atoll::Preferences {
     ulong mpuLogMs = 0;
     bool mpuAccelGyroNeedsCalibration = false;
     bool mpuMagNeedsCalibration = false;
+    bool mpuNeedsReconfiguration = false;  // rate profile or FIFO settings changed, applied in the task loop
+    bool mpuFifo = false;  // drain the MPU FIFO in bursts instead of polling single samples
+    bool mpuAdaptiveRate = true;  // retune the MPU sample rate and filter to the cadence
     void setup(const uint8_t sdaPin,
                const uint8_t sclPin,
                ::Preferences *p);
@@ -32,11 +46,17 @@ class Motion : public Atoll::Task, public Atoll::Preferences {
                const char *preferencesNS,
                uint8_t mpuAddress);
     void mpuEnableWomSleep();
+    void mpuWake();
+    void mpuClearWom();
     void mpuCalibrateAccelGyro();
     void mpuCalibrateMag();
     void mpuCalibrate();
     void printMpuAccelGyroCalibration();
     void printMpuMagCalibration();
+    void setMpuFifo(bool enabled);
+    void setMpuAdaptiveRate(bool enabled);
+    float crankAngle(ulong t = 0);
+    float crankRpm();
 
 #ifdef FEATURE_MPU_TEMPERATURE
     float getMpuTemperature();
@@ -47,6 +67,8 @@ class Motion : public Atoll::Task, public Atoll::Preferences {
 
 #endif  // FEATURE_MPU
 
+    float taskFreq();
+
     bool updateEnabled = false;
     ulong lastMovement = 0;
     uint16_t revolutions = 0;
@@ -55,8 +77,11 @@ class Motion : public Atoll::Task, public Atoll::Preferences {
     int hallOffset = HALL_DEFAULT_OFFSET;
     int hallThreshold = HALL_DEFAULT_THRESHOLD;
     int hallThresLow = HALL_DEFAULT_THRES_LOW;
+    HallSampler hallSampler;
 
-    void loop();
+    void selectPipeline();
+    void loop();  // in MDM_FUSED also called from the strain task
+    void onCrankEvent(const ulong t, int64_t us = -1);  // us < 0: derived from t
 
     int hall();
 
@@ -70,13 +95,57 @@ class Motion : public Atoll::Task, public Atoll::Preferences {
     void saveSettings();
 
    private:
+    typedef void (Motion::*Pipeline)(const ulong t);
+    Pipeline _pipeline = &Motion::_noDetectionLoop;  // per-method loop, see selectPipeline()
+    HysteresisDetector<int> _hallDetector;
+
     ulong _previousTime = 0;
+    int64_t _sampleUs = 0;  // time of the sample being processed
 #ifdef FEATURE_MPU
     float _previousAngle = 0.0;
     ulong _mpuLastLogMs = 0;
+    uint8_t _mpuAddress = 0x68;
+    MPU9250Setting _mpuSetting;
+    uint8_t _mpuProfile = MPU_RATE_PROFILE_DEFAULT;
+    ulong _mpuSampleUs = MPU_FIFO_SAMPLE_US;  // current sample period
+    ulong _mpuLastAdapt = 0;
+    float _fifoYaw = 0.0;           // gyro-integrated yaw in FIFO mode, -180...180
+    float _fifoTemperature = 0.0;   // last temperature from the FIFO
+
+    // MDM_MPU_GYRO
+    float _crankAngle = 0.0;      // 0...360
+    float _crankRate = 0.0;       // deg/s
+    ulong _crankAngleTime = 0;    // time of the last sample
+    ulong _lastGyroUs = 0;        // time of the last polled sample
+    float _accSumX = 0.0;         // accel sums of the current revolution
+    float _accSumY = 0.0;         //
+    uint16_t _accSamples = 0;     //
+    float _accMeanX = 0.0;        // accel means of the last revolution
+    float _accMeanY = 0.0;        //
+
+    struct MpuYawDetector;
+    struct MpuGyroDetector;
+    struct MpuFusedDetector;
+
+    bool _mpuPrepare();
+    template <class Detector>
+    void _mpuLoop(const ulong t);
+    template <class Detector>
+    void _mpuFifoLoop(const ulong t);
+    void _onMpuAngle(const float angle, const ulong t);
+    void _onMpuGyro(const float rateDps, const float ax, const float ay, const float dt, const ulong t, const bool crankEvents = true);
+    void _mpuFifoSetup();
+    void _mpuAdaptRate(const ulong t);
+    void _mpuSetProfile(const uint8_t profile);
+    bool _mpuWrite(uint8_t reg, uint8_t value);
+    bool _mpuRead(uint8_t reg, uint8_t *buf, uint8_t len);
 #endif
     bool _halfRevolution = false;
 
+    void _hallSetup();
+    void _hallLoop(const ulong t);
+    void _noDetectionLoop(const ulong t);
+
     float _prefGetValidFloat(const char *key, const float_t defaultValue);
     size_t _prefPutValidFloat(const char *key, const float_t value);
 };
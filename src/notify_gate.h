@@ -0,0 +1,43 @@
+#ifndef NOTIFY_GATE_H
+#define NOTIFY_GATE_H
+
+#include <Arduino.h>
+
+// Change suppression for a notified value: the value passes when it differs
+// from the last passed one by more than the deadband, or when the heartbeat
+// interval has passed since. With a zero deadband only unchanged values are
+// suppressed.
+class NotifyGate {
+   public:
+    float deadband = 0.0f;    // minimum change
+    ulong heartbeatMs = 0;    // maximum silence in ms, 0: none
+    uint32_t passed = 0;      // number of values sent
+    uint32_t suppressed = 0;  // number of values held back
+
+    NotifyGate(float deadband = 0.0f, ulong heartbeatMs = 0)
+        : deadband(deadband), heartbeatMs(heartbeatMs) {}
+
+    // Returns true if the value should be sent, force passes it regardless.
+    bool pass(const float value, const ulong t, const bool force = false) {
+        if (!force && _hasLast &&
+            fabsf(value - _last) <= deadband &&
+            (0 == heartbeatMs || t - _lastTime < heartbeatMs)) {
+            suppressed++;
+            return false;
+        }
+        _last = value;
+        _lastTime = t;
+        _hasLast = true;
+        passed++;
+        return true;
+    }
+
+    void reset() { _hasLast = false; }
+
+   protected:
+    float _last = 0.0f;
+    ulong _lastTime = 0;
+    bool _hasLast = false;
+};
+
+#endif
@@ -12,11 +12,73 @@ void Power::setup(::Preferences *p) {
 void Power::loop() {
     if (_lastCrankEventTime < millis() - POWER_ZERO_DELAY_MS) {
         _powerBuf.push(0.0);
+        resetRevolution();  // not pedalling, the samples do not belong to a revolution
     }
 }
 
-void Power::onCrankEvent(const ulong msSinceLastEvent) {
+// Accumulates a strain sample (kg) taken at time t into the metrics of the current revolution.
+void Power::onStrainSample(const float value, const ulong t) {
+    const float force = value * 9.80665;  // N
+    int16_t angle = -1;
+#ifdef FEATURE_MPU
+    if (trackAngles) angle = (int16_t)board.motion.crankAngle(t) % 360;
+#endif
+    float filtered = value;
+    bool discard = false;
+    switch (board.strain.negativeTorqueMethod) {
+        case NTM_KEEP:
+            break;
+        case NTM_ZERO:
+            if (filtered < 0.0) filtered = 0.0;
+            break;
+        case NTM_DISCARD:
+            if (filtered < 0.0) discard = true;
+            break;
+        case NTM_ABS:
+            filtered = abs(filtered);
+            break;
+        default:  // invalid negativeTorqueMethod
+            discard = true;
+    }
+    portENTER_CRITICAL(&_revMux);
+    Revolution *r = &_rev;
+    if (value < 0.0)
+        r->negative -= value;
+    else
+        r->positive += value;
+    if (!r->hasForce || r->forceMax < force) {
+        r->forceMax = force;
+        r->forceMaxAngle = angle;
+    }
+    if (!r->hasForce || force < r->forceMin) {
+        r->forceMin = force;
+        r->forceMinAngle = angle;
+    }
+    if (_prevForce <= 0.0 && 0.0 < force)
+        r->topDeadSpot = angle;
+    else if (0.0 < _prevForce && force <= 0.0)
+        r->bottomDeadSpot = angle;
+    _prevForce = force;
+    r->hasForce = true;
+    if (!discard) {
+        r->filtered += filtered;
+        r->samples++;
+        if (r->peak < filtered) r->peak = filtered;
+    }
+    portEXIT_CRITICAL(&_revMux);
+}
+
+// Discards the samples accumulated since the last crank event, e.g. when
+// pedalling restarts after a pause.
+void Power::resetRevolution() {
+    portENTER_CRITICAL(&_revMux);
+    _rev = Revolution();
+    portEXIT_CRITICAL(&_revMux);
+}
+
+void Power::onCrankEvent(const uint32_t usSinceLastEvent) {
     _lastCrankEventTime = millis();
+    updatePedalMetrics();
     if (!board.strain.dataReady()) {
         // log_e("strain not ready, skipping loop at %d, SPS=%f", millis(), board.strain.device->getSPS());
         return;
@@ -37,13 +99,24 @@ void Power::onCrankEvent(const ulong msSinceLastEvent) {
                                                 // power  = board.strain.value(true) / msSinceLastEvent * crankLength * 9.80665 * 2 * π
                                                 // power  = board.strain.value(true) / msSinceLastEvent * crankLength * 61.616999192652692
     */
-    float power = board.strain.value(true) / msSinceLastEvent * crankLength * 61.616999192652692;
-    if (reportDouble) power *= 2;
-    if (power < 0.0)
-        power = 0.0;
-    else if (10000.0 < power)
+    // msSinceLastEvent = usSinceLastEvent / 1000
+    float factor = crankLength * 61616.999192652692 / usSinceLastEvent;
+    powerRight = filterNegative(board.strain.value(true, STRAIN_RIGHT) * factor);
+    float power = powerRight;
+    if (1 < board.strain.numChannels()) {
+        powerLeft = filterNegative(board.strain.value(true, STRAIN_LEFT) * factor);
+        power += powerLeft;
+        balance = 0.0 < power ? powerLeft / power * 100.0 : -1.0;
+    } else if (reportDouble)
+        power *= 2;
+    if (10000.0 < power)
         power = 10000.0;
     _powerBuf.push(power);
+    // average torque of the revolution: P / ω = P * t / 2π
+    float torque32 = power * usSinceLastEvent / 1000000.0 / TWO_PI * 32.0 + _torqueFraction;
+    uint32_t whole = (uint32_t)torque32;
+    _torqueFraction = torque32 - whole;
+    accumulatedTorque += whole;  // rolls over
 }
 
 // Returns the average of the buffered power values, optionally emptying the buffer.
@@ -58,6 +131,32 @@ float Power::power(bool clearBuffer) {
     return power;
 }
 
+// Computes torque effectiveness and pedal smoothness from the accumulators of the
+// revolution that just ended, then resets the accumulators.
+// Torque effectiveness uses the unfiltered samples, so it shows the negative work
+// that negativeTorqueMethod may hide from the power value.
+void Power::updatePedalMetrics() {
+    portENTER_CRITICAL(&_revMux);
+    const Revolution r = _rev;
+    _rev = Revolution();
+    portEXIT_CRITICAL(&_revMux);
+    if (0.0 < r.positive)
+        torqueEffectiveness = (r.positive - r.negative) / r.positive * 100.0;
+    else
+        torqueEffectiveness = 0.0;
+    if (torqueEffectiveness < 0.0) torqueEffectiveness = 0.0;
+    if (0 < r.samples && 0.0 < r.peak)
+        pedalSmoothness = r.filtered / r.samples / r.peak * 100.0;
+    else
+        pedalSmoothness = 0.0;
+    forceMax = r.forceMax;
+    forceMin = r.forceMin;
+    forceMaxAngle = r.forceMaxAngle;
+    forceMinAngle = r.forceMinAngle;
+    topDeadSpot = r.topDeadSpot;
+    bottomDeadSpot = r.bottomDeadSpot;
+}
+
 void Power::loadSettings() {
     if (!preferencesStartLoad()) return;
     crankLength = preferences->getFloat("crankLength", 172.5);
@@ -20,11 +20,26 @@ class Power : public Atoll::Task, public Atoll::Preferences {
     bool reverseMPU;
     bool reverseStrain;
     bool reportDouble;
+    float torqueEffectiveness = 0.0f;  // last revolution, % of positive work not cancelled by negative work
+    float pedalSmoothness = 0.0f;      // last revolution, average / peak in %
+    float powerRight = 0.0f;           // last revolution, right side in W
+    float powerLeft = 0.0f;            // last revolution, left side in W
+    float balance = -1.0f;             // last revolution, left share in %, negative if unknown
+    uint16_t accumulatedTorque = 0;    // 1/32 Nm, rolls over, advanced by the average torque of each revolution
+    float forceMax = 0.0f;             // last revolution, extreme force of the right side in N
+    float forceMin = 0.0f;             //
+    int16_t forceMaxAngle = -1;        // last revolution, crank angle of the extremes in degrees, -1: unknown
+    int16_t forceMinAngle = -1;        //
+    int16_t topDeadSpot = -1;          // last revolution, crank angle where the force turned positive, -1: unknown
+    int16_t bottomDeadSpot = -1;       // last revolution, crank angle where the force turned negative, -1: unknown
+    bool trackAngles = false;          // record the crank angles of the extremes and the dead spots
 
     void setup(::Preferences *p);
     void loop();
     float power(bool clearBuffer = false);
-    void onCrankEvent(const ulong msSinceLastEvent);
+    void onStrainSample(const float value, const ulong t);
+    void onCrankEvent(const uint32_t usSinceLastEvent);
+    void resetRevolution();
     void loadSettings();
     void saveSettings();
     void printSettings();
@@ -33,6 +48,31 @@ class Power : public Atoll::Task, public Atoll::Preferences {
     CircularBuffer<float, POWER_RINGBUF_SIZE> _powerBuf;
     ulong _lastCrankEventTime = 0;
 
+    // Per-revolution accumulators, fed by onStrainSample() in the strain task and
+    // handed over to updatePedalMetrics() under _revMux, as crank events may come
+    // from the motion task.
+    struct Revolution {
+        float positive = 0.0f;  // sum of positive samples
+        float negative = 0.0f;  // sum of the magnitude of negative samples
+        float filtered = 0.0f;  // sum of samples filtered by negativeTorqueMethod
+        float peak = 0.0f;      // peak of samples filtered by negativeTorqueMethod
+        uint32_t samples = 0;   // number of samples in filtered
+        float forceMax = 0.0f;  // extremes of the unfiltered samples in N
+        float forceMin = 0.0f;  //
+        int16_t forceMaxAngle = -1;
+        int16_t forceMinAngle = -1;
+        int16_t topDeadSpot = -1;
+        int16_t bottomDeadSpot = -1;
+        bool hasForce = false;  // the extremes hold at least one sample
+    };
+
+    Revolution _rev;
+    float _prevForce = 0.0f;
+    portMUX_TYPE _revMux = portMUX_INITIALIZER_UNLOCKED;
+    float _torqueFraction = 0.0f;  // remainder of accumulatedTorque below 1/32 Nm
+
+    void updatePedalMetrics();
+
     float filterNegative(float value, bool reverse = false);
 };
 
@@ -0,0 +1,34 @@
+#include "rtc_state.h"
+
+#include <esp_sleep.h>
+#include <rom/crc.h>
+
+RTC_DATA_ATTR static RtcState::Data rtcStateData;
+
+RtcState::RtcState() : data(&rtcStateData) {}
+
+// Returns true if we woke from deep sleep and the retained data is intact.
+// RTC memory also survives a software reset, hence the wakeup cause check.
+bool RtcState::check() {
+    if (ESP_SLEEP_WAKEUP_EXT0 != esp_sleep_get_wakeup_cause()) return false;
+    if (RTC_STATE_MAGIC != data->magic) return false;
+    if (_crc() != data->crc) {
+        log_e("crc mismatch");
+        return false;
+    }
+    return true;
+}
+
+// Seals the data, call right before entering deep sleep.
+void RtcState::commit() {
+    data->magic = RTC_STATE_MAGIC;
+    data->crc = _crc();
+}
+
+void RtcState::invalidate() {
+    data->magic = 0;
+}
+
+uint32_t RtcState::_crc() {
+    return crc32_le(0, (const uint8_t *)data, offsetof(Data, crc));
+}
@@ -0,0 +1,34 @@
+#ifndef RTC_STATE_H
+#define RTC_STATE_H
+
+#include <Arduino.h>
+
+#include "definitions.h"
+
+#define RTC_STATE_MAGIC 0x45535031  // "ESP1"
+
+// Pipeline state retained in RTC slow memory during deep sleep, so a wake from
+// motion resumes without re-taring the strain gauges.
+class RtcState {
+   public:
+    struct Data {
+        uint32_t magic;
+        int32_t tareOffset[STRAIN_CHANNELS];  // HX711 tare offsets
+        float calFactor[STRAIN_CHANNELS];     // HX711 calibration factors
+        float tcOffset;                       // temperature compensation offset in kg
+        uint16_t revolutions;                 // crank revolutions, continued over BLE
+        uint32_t crc;                         // of the fields above
+    };
+
+    Data *data;
+
+    RtcState();
+    bool check();
+    void commit();
+    void invalidate();
+
+   protected:
+    uint32_t _crc();
+};
+
+#endif
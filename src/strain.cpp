@@ -1,109 +1,219 @@
 #include "board.h"
 #include "strain.h"
 
-void Strain::setup(const gpio_num_t doutPin,
-                   const gpio_num_t sckPin,
+void Strain::setup(const gpio_num_t *doutPins,
+                   const gpio_num_t *sckPins,
                    ::Preferences *p,
-                   const char *preferencesNS) {
-    this->doutPin = doutPin;
-    this->sckPin = sckPin;
-    _measurementBuf.clear();
+                   const char *preferencesNS,
+                   const gpio_num_t ratePin) {
     preferencesSetup(p, preferencesNS);
-    rtc_gpio_hold_dis(sckPin);  // required to put HX711 into sleep mode
-    device = new HX711_ADC(doutPin, sckPin);
-    device->begin();
-    log_i("[STRAIN] Starting HX711, tare");
+    _ratePin = ratePin;
+    if (GPIO_NUM_NC != _ratePin) {
+        pinMode(_ratePin, OUTPUT);
+        digitalWrite(_ratePin, HIGH);
+    }
     ulong stabilizingTime = 1000 / 80;  // 80 sps
-    device->start(stabilizingTime, false);
-    // device->tare();
-    device->tareNoDelay();
-    // if (device->getTareTimeoutFlag()) {
-    //     Serial.println("[Strain] HX711 tare timeout");
-    // }
+    // after a wake from motion the tare offsets are still valid, no need to re-tare
+    const RtcState::Data *rtc = board.fastWake ? board.rtcState.data : nullptr;
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        Channel *c = &channels[i];
+        c->doutPin = doutPins[i];
+        c->sckPin = sckPins[i];
+        c->buf.clear();
+        rtc_gpio_hold_dis(c->sckPin);  // required to put HX711 into sleep mode
+        c->device = new HX711_ADC(c->doutPin, c->sckPin);
+        c->device->begin();
+        if (nullptr != rtc) {
+            log_i("[STRAIN] Starting HX711 #%d, restoring tare", i);
+            c->device->start(stabilizingTime, false);
+            c->device->setTareOffset(rtc->tareOffset[i]);
+            continue;
+        }
+        log_i("[STRAIN] Starting HX711 #%d, tare", i);
+        c->device->start(stabilizingTime, false);
+        // c->device->tare();
+        c->device->tareNoDelay();
+        // if (c->device->getTareTimeoutFlag()) {
+        //     Serial.println("[Strain] HX711 tare timeout");
+        // }
+    }
     setAutoTareDelayMs(AUTO_TARE_DELAY_MS, false);
     loadSettings();
+    if (nullptr != rtc)
+        for (uint8_t i = 0; i < numChannels(); i++)
+            channels[i].device->setCalFactor(rtc->calFactor[i]);
+    _setFastRate(STRAIN_RATE_SLOW != rateMode);
+    selectPipeline();
+}
+
+// Selects the loop for the motion detection method, called before the task is started.
+void Strain::selectPipeline() {
+    _pipeline = &Strain::_loop<MDM_MAX>;
+    if (board.motionDetectionMethod == MDM_STRAIN)
+        _pipeline = &Strain::_loop<MDM_STRAIN>;
+#ifdef FEATURE_MPU
+    else if (board.motionDetectionMethod == MDM_FUSED) {
+        board.motion.selectPipeline();
+        fusion.reset();
+        _pipeline = &Strain::_loop<MDM_FUSED>;
+    }
+#endif
 }
 
 void Strain::loop() {
-    if (1 != device->update())  // 1: data ready; 2: tare complete
-        return;
-    _measurementBuf.push(device->getData());
-    ulong t = millis();
-    if (board.motionDetectionMethod == MDM_STRAIN) {
-        if (!_halfRevolution) {
-            if (_measurementBuf.last() <= mdmStrainThresLow) {
-                _halfRevolution = true;
-            }
-        } else if (mdmStrainThreshold <= _measurementBuf.last()) {
-            _halfRevolution = false;
-            board.motion.lastMovement = t;
-            if (0 < board.motion.lastCrankEventTime) {
-                ulong dt = t - board.motion.lastCrankEventTime;
-                if (CRANK_EVENT_MIN_MS < dt) {
-                    board.motion.revolutions++;
-                    log_i("Crank event #%d dt: %ldms", board.motion.revolutions, dt);
-                    board.power.onCrankEvent(dt);
-                    board.bleServer.onCrankEvent(t, board.motion.revolutions);
-                    board.motion.lastCrankEventTime = t;
-                } else {
-                    // Serial.printf("[STRAIN] Crank event skip, dt too small: %ldms\n", tDiff);
-                }
-            } else {
-                board.motion.lastCrankEventTime = t;
-            }
+    _sampleUs = Timebase::us();
+    (this->*_pipeline)(Timebase::toMillis(_sampleUs));
+}
+
+// Polls all channels once, a channel is only read when its conversion is ready,
+// so the reads of the channels are interleaved and never wait for each other.
+// In MDM_FUSED the MPU is polled from here too, so the fusion sees both sensors
+// in a single task.
+template <uint8_t method>
+void Strain::_loop(const ulong t) {
+#ifdef FEATURE_MPU
+    if (MDM_FUSED == method) board.motion.loop();
+#endif
+    if (_lastRateCheck + 1000 < t) _checkRate(t);
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        Channel *c = &channels[i];
+        if (1 != c->device->update())  // 1: data ready; 2: tare complete
+            continue;
+        if (t < _settleUntil) continue;  // conversions after a rate change are invalid
+        float v = c->device->getData();
+        c->lastRaw = v * fabs(c->device->getCalFactor());
+        c->curve.evaluate(c->lastRaw, &v);  // leaves v unchanged if the curve is off
+        c->buf.push(v);
+        if (STRAIN_RIGHT != i) continue;
+        board.power.onStrainSample(liveValue(STRAIN_RIGHT), t);
+        board.bleServer.onStrainSample(t);
+        if (MDM_MAX == method) continue;
+        const bool trigger = _detector.update(c->buf.last(), mdmStrainThresLow, mdmStrainThreshold);
+        if (MDM_STRAIN == method) {
+            if (trigger) board.motion.onCrankEvent(t, _sampleUs);
+            continue;
         }
+#ifdef FEATURE_MPU
+        ulong eventTime;
+        if (fusion.update(trigger, board.motion.crankAngle(t), board.motion.crankRpm(), t, &eventTime))
+            board.motion.onCrankEvent(eventTime);
+#endif
     }
     if (autoTare && autoTareDelayMs < t) {
         ulong cutoff = t - autoTareDelayMs;
-        if (board.motion.lastCrankEventTime < cutoff && _lastAutoTare < cutoff && 0 < _measurementBuf.size()) {
-            float min = 1000.0;
-            float max = -1000.0;
-            int16_t firstSample = _measurementBuf.size() - autoTareSamples;
-            if (firstSample < 0) firstSample = 0;
-            for (decltype(_measurementBuf)::index_t i = _measurementBuf.size() - 1; firstSample < i; i--) {
-                if (_measurementBuf[i] < min) min = _measurementBuf[i];
-                if (max < _measurementBuf[i]) max = _measurementBuf[i];
-            }
+        if (board.motion.lastCrankEventTime < cutoff && _lastAutoTare < cutoff && dataReady()) {
             _lastAutoTare = t;
-            if (abs(max - min) < autoTareRangeG / 1000.0) {
-                // log_i("Auto tare: %.2f, %.2f", min, max);
-                device->tareNoDelay();
-                //_lastAutoTare = t;
-            } else {
-                // log_i("Auto tare range too large: %fkg > %dg", max - min, autoTareRangeG);
+            for (uint8_t i = 0; i < numChannels(); i++) {
+                if (_channelStill(i)) {
+                    // log_i("Auto tare #%d", i);
+                    channels[i].device->tareNoDelay();
+                }
             }
         }
     }
 }
 
-// returns the average of the measurement values in the buffer, optionally emptying the buffer
-float Strain::value(bool clearBuffer) {
+// Updates the measured conversion rate and the windows derived from it, and
+// switches between 10 and 80 sps in auto rate mode.
+void Strain::_checkRate(const ulong t) {
+    _lastRateCheck = t;
+    if (t < _settleUntil) return;
+    float measured = channels[STRAIN_RIGHT].device->getSPS();
+    if (!isnan(measured) && !isinf(measured) && 1.0f < measured && measured < 100.0f) {
+        sps = measured;
+        setAutoTareDelayMs(autoTareDelayMs, false);
+    }
+    if (GPIO_NUM_NC == _ratePin || STRAIN_RATE_AUTO != rateMode) return;
+    bool moving = t - board.motion.lastMovement < STRAIN_IDLE_RATE_MS;
+    if (moving != _fastRate) _setFastRate(moving);
+}
+
+// Sets the HX711 rate pin and scales the moving average and the task
+// frequency, so the time windows stay the same at both rates.
+void Strain::_setFastRate(bool fast) {
+    if (GPIO_NUM_NC == _ratePin) return;
+    digitalWrite(_ratePin, fast ? HIGH : LOW);
+    _fastRate = fast;
+    sps = fast ? 80.0f : 10.0f;
+    for (uint8_t i = 0; i < numChannels(); i++)
+        channels[i].device->setSamplesInUse(fast ? HX711_SAMPLES : HX711_SAMPLES / 8);
+    _settleUntil = millis() + (fast ? HX711_SETTLING_FAST_MS : HX711_SETTLING_SLOW_MS);
+    setAutoTareDelayMs(autoTareDelayMs, false);
+    board.setTaskFreq("strain", taskFreq());
+    log_i("%d sps", fast ? 80 : 10);
+}
+
+bool Strain::isFastRate() {
+    return _fastRate;
+}
+
+// Returns the task frequency for the current rate. The fused pipeline polls
+// the MPU from this task, so it keeps the fast frequency at 10 sps as well,
+// at STRAIN_IDLE_TASK_FREQ the crank angle would be integrated at 12 Hz.
+float Strain::taskFreq() {
+    if (_fastRate || MDM_FUSED == board.motionDetectionMethod) return STRAIN_TASK_FREQ;
+    return STRAIN_IDLE_TASK_FREQ;
+}
+
+bool Strain::hasRatePin() {
+    return GPIO_NUM_NC != _ratePin;
+}
+
+// Returns false if the mode is invalid or the rate is hardwired.
+bool Strain::setRateMode(uint8_t mode) {
+    if (STRAIN_RATE_MAX <= mode || !hasRatePin()) return false;
+    rateMode = mode;
+    if (STRAIN_RATE_AUTO != rateMode) _setFastRate(STRAIN_RATE_FAST == rateMode);
+    return true;
+}
+
+// whether the recent values of the channel are within the auto tare range
+bool Strain::_channelStill(uint8_t channel) {
+    Channel *c = &channels[channel];
+    if (c->buf.isEmpty()) return false;
+    float min = 1000.0;
+    float max = -1000.0;
+    int16_t firstSample = c->buf.size() - autoTareSamples;
+    if (firstSample < 0) firstSample = 0;
+    for (decltype(c->buf)::index_t i = c->buf.size() - 1; firstSample < i; i--) {
+        if (c->buf[i] < min) min = c->buf[i];
+        if (max < c->buf[i]) max = c->buf[i];
+    }
+    if (abs(max - min) < autoTareRangeG / 1000.0) return true;
+    // log_i("Auto tare range too large: %fkg > %dg", max - min, autoTareRangeG);
+    return false;
+}
+
+// returns the average of the measurement values in the buffer of the channel, optionally emptying the buffer
+float Strain::value(bool clearBuffer, uint8_t channel) {
     float avg = 0.0;
-    if (!dataReady()) return avg;
+    if (!dataReady(channel)) return avg;
+    CircularBuffer<float, STRAIN_RINGBUF_SIZE> *buf = &channels[channel].buf;
     float sum = 0.0;
-    decltype(_measurementBuf)::index_t nValidMeasurements = 0;
-    for (decltype(_measurementBuf)::index_t i = 0; i < _measurementBuf.size(); i++) {
+    CircularBuffer<float, STRAIN_RINGBUF_SIZE>::index_t nValidMeasurements = 0;
+    for (CircularBuffer<float, STRAIN_RINGBUF_SIZE>::index_t i = 0; i < buf->size(); i++) {
+        float v = (*buf)[i];
         switch (negativeTorqueMethod) {
             case NTM_KEEP:
                 nValidMeasurements++;
-                sum += _measurementBuf[i];
+                sum += v;
                 break;
             case NTM_ZERO:
                 nValidMeasurements++;
-                if (_measurementBuf[i] < 0.0)
+                if (v < 0.0)
                     sum += 0.0;
                 else
-                    sum += _measurementBuf[i];
+                    sum += v;
                 break;
             case NTM_DISCARD:
-                if (0.0 <= _measurementBuf[i]) {
+                if (0.0 <= v) {
                     nValidMeasurements++;
-                    sum += _measurementBuf[i];
+                    sum += v;
                 }
                 break;
             case NTM_ABS:
                 nValidMeasurements++;
-                sum += abs(_measurementBuf[i]);
+                sum += abs(v);
                 break;
             default:  // invalid negativeTorqueMethod
                 break;
@@ -111,32 +221,53 @@ float Strain::value(bool clearBuffer) {
     }
     if (0 < nValidMeasurements)
         avg = sum / nValidMeasurements;
-    if (clearBuffer) _measurementBuf.clear();
+    if (clearBuffer) buf->clear();
 
 #if defined(FEATURE_TEMPERATURE) && defined(FEATURE_TEMPERATURE_COMPENSATION)
-    avg += board.temperature.getCompensation();
+    // the compensation table belongs to the gauge next to the temperature sensor
+    if (STRAIN_RIGHT == channel) avg += board.temperature.getCompensation();
 #endif
 
     return avg;
 }
 
-float Strain::liveValue() {
-    return dataReady() ? _measurementBuf.last()
+float Strain::liveValue(int8_t channel) {
+    if (channel < 0) {
+        float sum = 0.0;
+        for (uint8_t i = 0; i < numChannels(); i++) sum += liveValue(i);
+        return sum;
+    }
+    if (!dataReady(channel)) return 0.0;
+    float v = channels[channel].buf.last();
 
 #if defined(FEATURE_TEMPERATURE) && defined(FEATURE_TEMPERATURE_COMPENSATION)
-                             + board.temperature.getCompensation()
+    if (STRAIN_RIGHT == channel) v += board.temperature.getCompensation();
 #endif
 
-                       : 0.0;
+    return v;
 }
 
-bool Strain::dataReady() {
-    return 0 < _measurementBuf.size();
+bool Strain::dataReady(uint8_t channel) {
+    if (numChannels() <= channel) return false;
+    return 0 < channels[channel].buf.size();
+}
+
+uint8_t Strain::numChannels() {
+    return STRAIN_CHANNELS;
 }
 
 void Strain::sleep() {
-    device->powerDown();
-    rtc_gpio_hold_en(sckPin);
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        channels[i].device->powerDown();
+        rtc_gpio_hold_en(channels[i].sckPin);
+    }
+}
+
+void Strain::wake() {
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        rtc_gpio_hold_dis(channels[i].sckPin);
+        channels[i].device->powerUp();
+    }
 }
 
 void Strain::setMdmStrainThreshold(int threshold) {
@@ -147,8 +278,13 @@ void Strain::setMdmStrainThresLow(int threshold) {
     mdmStrainThresLow = threshold;
 }
 
-// calibrate to a known mass in kg
-int Strain::calibrateTo(float knownMass) {
+// calibrate the channel to a known mass in kg
+int Strain::calibrateTo(float knownMass, uint8_t channel) {
+    if (numChannels() <= channel) {
+        log_e("invalid channel %d", channel);
+        return -1;
+    }
+    HX711_ADC *device = channels[channel].device;
     float calFactor = device->getCalFactor();
     if (isnan(calFactor) ||
         isinf(calFactor) ||
@@ -163,11 +299,48 @@ int Strain::calibrateTo(float knownMass) {
         return -1;
     }
     device->getNewCalibration(knownMass);
+    channels[channel].calibrated = true;
     return 0;
 }
 
+// Adds a point to the calibration curve of the channel at the current reading.
+int Strain::addCalibrationPoint(float knownMass, uint8_t channel) {
+    if (!dataReady(channel)) {
+        log_e("no data on channel %d", channel);
+        return -1;
+    }
+    if (!channels[channel].curve.addPoint((int32_t)channels[channel].lastRaw, knownMass)) {
+        log_e("could not add point %.2fkg to channel %d", knownMass, channel);
+        return -1;
+    }
+    return 0;
+}
+
+bool Strain::setCurveMode(uint8_t mode, uint8_t channel) {
+    if (numChannels() <= channel) return false;
+    return channels[channel].curve.setMode(mode);
+}
+
+void Strain::clearCurve(uint8_t channel) {
+    if (numChannels() <= channel) return;
+    channels[channel].curve.clear();
+}
+
 void Strain::printSettings() {
-    log_i("Calibration factor: %f", device->getCalFactor());
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        log_i("Calibration factor #%d: %f", i, channels[i].device->getCalFactor());
+        StrainCurve *curve = &channels[i].curve;
+        for (uint8_t j = 0; j < curve->size(); j++)
+            log_i("Calibration curve #%d point %d: %d -> %dg", i, j, curve->point(j)->raw, curve->point(j)->grams);
+    }
+}
+
+// Channel 0 uses the plain key, other channels have their index appended.
+void Strain::_prefKey(char *buf, size_t size, const char *key, uint8_t channel) {
+    if (0 == channel)
+        snprintf(buf, size, "%s", key);
+    else
+        snprintf(buf, size, "%s%d", key, channel);
 }
 
 void Strain::loadSettings() {
@@ -178,12 +351,28 @@ void Strain::loadSettings() {
     setAutoTare(preferences->getBool("autoTare", autoTare));
     setAutoTareDelayMs(preferences->getULong("ATDelayMs", autoTareDelayMs));
     setAutoTareRangeG(preferences->getUShort("ATRangeG", autoTareRangeG));
-    if (!preferences->getBool("calibrated", false)) {
-        preferencesEnd();
-        log_e("Device has not yet been calibrated");
-        return;
+    rateMode = preferences->getUChar("rateMode", rateMode);
+    if (STRAIN_RATE_MAX <= rateMode) rateMode = STRAIN_RATE_AUTO;
+    char key[16];
+    uint8_t curveBytes[STRAIN_CURVE_MAX_POINTS * sizeof(StrainCurve::Point)];
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        _prefKey(key, sizeof(key), "curve", i);
+        size_t curveSize = preferences->getBytesLength(key);
+        if (0 < curveSize && curveSize <= sizeof(curveBytes)) {
+            preferences->getBytes(key, curveBytes, curveSize);
+            channels[i].curve.setBytes(curveBytes, curveSize);
+        }
+        _prefKey(key, sizeof(key), "curveMode", i);
+        channels[i].curve.setMode(preferences->getUChar(key, STRAIN_CURVE_OFF));
+        _prefKey(key, sizeof(key), "calibrated", i);
+        channels[i].calibrated = preferences->getBool(key, false);
+        if (!channels[i].calibrated) {
+            log_e("Device #%d has not yet been calibrated", i);
+            continue;
+        }
+        _prefKey(key, sizeof(key), "calibration", i);
+        channels[i].device->setCalFactor(preferences->getFloat(key, 0.0));
     }
-    device->setCalFactor(preferences->getFloat("calibration", 0.0));
     preferencesEnd();
 }
 
@@ -195,13 +384,29 @@ void Strain::saveSettings() {
     preferences->putBool("autoTare", autoTare);
     preferences->putULong("ATDelayMs", autoTareDelayMs);
     preferences->putUShort("ATRangeG", autoTareRangeG);
-    preferences->putBool("calibrated", true);
-    preferences->putFloat("calibration", device->getCalFactor());
+    preferences->putUChar("rateMode", rateMode);
+    char key[16];
+    for (uint8_t i = 0; i < numChannels(); i++) {
+        _prefKey(key, sizeof(key), "calibrated", i);
+        preferences->putBool(key, channels[i].calibrated);
+        _prefKey(key, sizeof(key), "calibration", i);
+        if (channels[i].calibrated)
+            preferences->putFloat(key, channels[i].device->getCalFactor());
+        StrainCurve *curve = &channels[i].curve;
+        _prefKey(key, sizeof(key), "curve", i);
+        if (0 < curve->size())
+            preferences->putBytes(key, curve->bytes(), curve->bytesSize());
+        else if (preferences->isKey(key))
+            preferences->remove(key);
+        _prefKey(key, sizeof(key), "curveMode", i);
+        preferences->putUChar(key, curve->getMode());
+    }
     preferencesEnd();
 }
 
 void Strain::tare() {
-    device->tare();
+    for (uint8_t i = 0; i < numChannels(); i++)
+        channels[i].device->tare();
 #if defined(FEATURE_TEMPERATURE) && defined(FEATURE_TEMPERATURE_COMPENSATION)
     board.temperature.setCompensationOffset();
 #endif
@@ -222,7 +427,7 @@ ulong Strain::getAutoTareDelayMs() {
 
 void Strain::setAutoTareDelayMs(ulong val, bool log) {
     autoTareDelayMs = val;
-    autoTareSamples = val / 1000 * STRAIN_TASK_FREQ;
+    autoTareSamples = val * sps / 1000;
     if (log) log_i("autoTareDelayMs=%lu autoTareSamples=%d", autoTareDelayMs, autoTareSamples);
 }
 
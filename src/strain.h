@@ -8,36 +8,73 @@
 
 #include "atoll_preferences.h"
 #include "atoll_task.h"
+#include "crank_detector.h"
+#include "crank_fusion.h"
+#include "strain_curve.h"
+#include "timebase.h"
 
 #ifndef STRAIN_RINGBUF_SIZE
 #define STRAIN_RINGBUF_SIZE 512  // circular buffer size
 #endif
 
+#ifndef STRAIN_CHANNELS
+#define STRAIN_CHANNELS 1  // number of HX711s
+#endif
+
+#define STRAIN_RIGHT 0  // channel index of the right crank
+#define STRAIN_LEFT 1   // channel index of the left crank
+
+#define STRAIN_RATE_AUTO 0  // switch between 10 and 80 sps depending on movement
+#define STRAIN_RATE_SLOW 1  // 10 sps
+#define STRAIN_RATE_FAST 2  // 80 sps
+#define STRAIN_RATE_MAX 3   // marks the high limit
+#define STRAIN_RATE_FIXED 0xff  // reported when no rate pin is wired, the rate can not be set
+
 class Strain : public Atoll::Task,
                public Atoll::Preferences {
    public:
     const char *taskName() { return "Strain"; }
-    HX711_ADC *device;
-    gpio_num_t doutPin;
-    gpio_num_t sckPin;
+
+    struct Channel {
+        HX711_ADC *device = nullptr;
+        gpio_num_t doutPin;
+        gpio_num_t sckPin;
+        CircularBuffer<float, STRAIN_RINGBUF_SIZE> buf;
+        StrainCurve curve;     // optional nonlinear calibration
+        float lastRaw = 0.0f;  // last tared reading scaled by the magnitude of the calibration factor
+        bool calibrated = false;  // the calibration factor was set by calibrateTo()
+    };
+
+    Channel channels[STRAIN_CHANNELS];
     int mdmStrainThreshold = MDM_STRAIN_DEFAULT_THRESHOLD;
     int mdmStrainThresLow = MDM_STRAIN_DEFAULT_THRES_LOW;
     uint8_t negativeTorqueMethod = NEGATIVE_TORQUE_METHOD;
+    uint8_t rateMode = STRAIN_RATE_AUTO;
+    float sps = 80.0f;  // measured conversion rate
+    CrankFusion fusion;  // MDM_FUSED
 
-    void setup(const gpio_num_t doutPin,
-               const gpio_num_t sckPin,
+    // doutPins and sckPins hold STRAIN_CHANNELS pins each
+    void setup(const gpio_num_t *doutPins,
+               const gpio_num_t *sckPins,
                ::Preferences *p,
-               const char *preferencesNS = "STRAIN");
+               const char *preferencesNS = "STRAIN",
+               const gpio_num_t ratePin = GPIO_NUM_NC);
 
+    void selectPipeline();
     void loop();
 
-    float value(bool clearBuffer = false);
-    float liveValue();
-    bool dataReady();
+    float value(bool clearBuffer = false, uint8_t channel = STRAIN_RIGHT);
+    float liveValue(int8_t channel = -1);  // -1: sum of all channels
+    bool dataReady(uint8_t channel = STRAIN_RIGHT);
+    uint8_t numChannels();
     void sleep();
+    void wake();
     void setMdmStrainThreshold(int threshold);
     void setMdmStrainThresLow(int threshold);
-    int calibrateTo(float knownMass);  // calibrate to a known mass in kg
+    int calibrateTo(float knownMass, uint8_t channel = STRAIN_RIGHT);  // calibrate to a known mass in kg
+    int addCalibrationPoint(float knownMass, uint8_t channel = STRAIN_RIGHT);
+    bool setCurveMode(uint8_t mode, uint8_t channel = STRAIN_RIGHT);
+    void clearCurve(uint8_t channel = STRAIN_RIGHT);
     void printSettings();
     void loadSettings();
     void saveSettings();
@@ -48,15 +85,34 @@ class Strain : public Atoll::Task,
     void setAutoTareDelayMs(ulong val, bool log = true);
     uint16_t getAutoTareRangeG();
     void setAutoTareRangeG(uint16_t val);
+    bool isFastRate();
+    float taskFreq();
+    bool hasRatePin();
+    bool setRateMode(uint8_t mode);
 
    private:
-    CircularBuffer<float, STRAIN_RINGBUF_SIZE> _measurementBuf;
-    bool _halfRevolution = false;
+    gpio_num_t _ratePin = GPIO_NUM_NC;
+    bool _fastRate = true;
+    ulong _settleUntil = 0;
+    ulong _lastRateCheck = 0;
+    int64_t _sampleUs = 0;  // time of the current loop
+
+    typedef void (Strain::*Pipeline)(const ulong t);
+    Pipeline _pipeline = nullptr;  // see selectPipeline()
+    HysteresisDetector<float> _detector;
     bool autoTare = AUTO_TARE;
     ulong autoTareDelayMs = AUTO_TARE_DELAY_MS;
     uint16_t autoTareRangeG = AUTO_TARE_RANGE_G;
-    uint16_t autoTareSamples = AUTO_TARE_DELAY_MS / 1000 * STRAIN_TASK_FREQ;
+    uint16_t autoTareSamples = AUTO_TARE_DELAY_MS * 80 / 1000;
     ulong _lastAutoTare = 0;
+
+    template <uint8_t method>  // MDM_STRAIN, MDM_FUSED or MDM_MAX for no crank detection
+    void _loop(const ulong t);
+    void _checkRate(const ulong t);
+    void _setFastRate(bool fast);
+
+    bool _channelStill(uint8_t channel);
+    void _prefKey(char *buf, size_t size, const char *key, uint8_t channel);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,175 @@
+#include "strain_curve.h"
+
+// Adds a point keeping the points sorted by raw value, a point with the same
+// raw value is replaced.
+bool StrainCurve::addPoint(int32_t raw, float kg) {
+    if (raw <= 0 || kg <= 0.0f) {
+        log_e("raw value and mass must be positive");
+        return false;
+    }
+    int32_t grams = (int32_t)(kg * 1000.0f);
+    uint8_t i = 0;
+    while (i < _size && _points[i].raw < raw) i++;
+    if (i < _size && _points[i].raw == raw) {
+        _points[i].grams = grams;
+        return fit();
+    }
+    if (STRAIN_CURVE_MAX_POINTS <= _size) {
+        log_e("table full");
+        return false;
+    }
+    for (uint8_t j = _size; i < j; j--) _points[j] = _points[j - 1];
+    _points[i].raw = raw;
+    _points[i].grams = grams;
+    _size++;
+    return fit();
+}
+
+void StrainCurve::clear() {
+    _size = 0;
+    Fit f;
+    _publish(&f);
+}
+
+uint8_t StrainCurve::size() {
+    return _size;
+}
+
+const StrainCurve::Point *StrainCurve::point(uint8_t index) {
+    if (_size <= index) return nullptr;
+    return &_points[index];
+}
+
+uint8_t StrainCurve::getMode() {
+    return _mode;
+}
+
+// The mode is only changed if the points can be fitted with it.
+bool StrainCurve::setMode(uint8_t mode) {
+    if (STRAIN_CURVE_MAX <= mode) return false;
+    Fit f;
+    if (!_compute(mode, &f)) return false;
+    _mode = mode;
+    _publish(&f);
+    return true;
+}
+
+bool StrainCurve::enabled() {
+    return STRAIN_CURVE_OFF != _fit.mode;
+}
+
+// Fits the points with the current mode, the curve is disabled if they can
+// not be fitted.
+bool StrainCurve::fit() {
+    Fit f;
+    bool ok = _compute(_mode, &f);
+    if (!ok) f.mode = STRAIN_CURVE_OFF;
+    _publish(&f);
+    return ok;
+}
+
+// Precomputes the segment slopes or the quadratic coefficients into f.
+bool StrainCurve::_compute(uint8_t mode, Fit *f) {
+    f->mode = STRAIN_CURVE_OFF;
+    if (STRAIN_CURVE_OFF == mode) return true;
+    if (0 == _size) return false;
+    if (STRAIN_CURVE_PWL == mode) {
+        float prevRaw = 0.0f;
+        float prevKg = 0.0f;
+        for (uint8_t i = 0; i < _size; i++) {
+            float raw = _points[i].raw;
+            float kg = _points[i].grams / 1000.0f;
+            if (raw == prevRaw) return false;
+            f->slopes[i] = (kg - prevKg) / (raw - prevRaw);
+            f->intercepts[i] = kg - f->slopes[i] * raw;
+            f->knots[i] = raw;
+            prevRaw = raw;
+            prevKg = kg;
+        }
+        // extend the last segment beyond the last point
+        f->knots[_size - 1] = INFINITY;
+        f->mode = mode;
+        return true;
+    }
+    if (STRAIN_CURVE_QUAD == mode) {
+        // minimize sum((b * x + c * x^2 - y)^2)
+        double sx2 = 0, sx3 = 0, sx4 = 0, sxy = 0, sx2y = 0;
+        for (uint8_t i = 0; i < _size; i++) {
+            double x = _points[i].raw;
+            double y = _points[i].grams / 1000.0;
+            sx2 += x * x;
+            sx3 += x * x * x;
+            sx4 += x * x * x * x;
+            sxy += x * y;
+            sx2y += x * x * y;
+        }
+        if (1 == _size) {
+            f->b = sxy / sx2;
+            f->c = 0.0f;
+        } else {
+            double det = sx2 * sx4 - sx3 * sx3;
+            if (0.0 == det) return false;
+            f->b = (sxy * sx4 - sx2y * sx3) / det;
+            f->c = (sx2 * sx2y - sx3 * sxy) / det;
+        }
+        f->mode = mode;
+        return true;
+    }
+    return false;
+}
+
+void StrainCurve::_publish(const Fit *f) {
+    portENTER_CRITICAL(&_mux);
+    _fit = *f;
+    portEXIT_CRITICAL(&_mux);
+}
+
+// Sets kg to the mass for a tared raw reading, negative readings are mirrored
+// onto the curve. Returns false if the curve is not enabled.
+bool StrainCurve::evaluate(float raw, float *kg) {
+    float x = raw < 0.0f ? -raw : raw;
+    float v;
+    portENTER_CRITICAL(&_mux);
+    if (STRAIN_CURVE_OFF == _fit.mode) {
+        portEXIT_CRITICAL(&_mux);
+        return false;
+    }
+    if (STRAIN_CURVE_QUAD == _fit.mode)
+        v = (_fit.b + _fit.c * x) * x;
+    else {
+        uint8_t i = 0;
+        while (_fit.knots[i] < x) i++;
+        v = _fit.slopes[i] * x + _fit.intercepts[i];
+    }
+    portEXIT_CRITICAL(&_mux);
+    *kg = raw < 0.0f ? -v : v;
+    return true;
+}
+
+size_t StrainCurve::bytesSize() {
+    return _size * sizeof(Point);
+}
+
+const uint8_t *StrainCurve::bytes() {
+    return (const uint8_t *)_points;
+}
+
+bool StrainCurve::setBytes(const uint8_t *bytes, size_t size) {
+    if (size % sizeof(Point) || STRAIN_CURVE_MAX_POINTS * sizeof(Point) < size) {
+        log_e("invalid size %d", size);
+        return false;
+    }
+    // same constraints as addPoint(): positive values, sorted by raw
+    Point points[STRAIN_CURVE_MAX_POINTS];
+    const uint8_t n = size / sizeof(Point);
+    memcpy(points, bytes, size);
+    for (uint8_t i = 0; i < n; i++) {
+        if (points[i].raw <= 0 || points[i].grams <= 0 || (0 < i && points[i].raw <= points[i - 1].raw)) {
+            log_e("invalid point %d", i);
+            return false;
+        }
+    }
+    memcpy(_points, points, size);
+    _size = n;
+    return fit();
+}
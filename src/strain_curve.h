@@ -0,0 +1,67 @@
+#ifndef STRAIN_CURVE_H
+#define STRAIN_CURVE_H
+
+#include <Arduino.h>
+
+#ifndef STRAIN_CURVE_MAX_POINTS
+#define STRAIN_CURVE_MAX_POINTS 8  // maximum number of calibration points
+#endif
+
+#define STRAIN_CURVE_OFF 0   // curve disabled, the linear calibration factor is used
+#define STRAIN_CURVE_PWL 1   // piecewise-linear interpolation between the points
+#define STRAIN_CURVE_QUAD 2  // least squares quadratic fit through the origin
+#define STRAIN_CURVE_MAX 3   // marks the high limit
+
+// Nonlinear calibration curve mapping tared raw HX711 readings to kg.
+// Points are positive, the tare point (0, 0) is implicit. Slopes and coefficients are precomputed
+// by fit(), evaluate() is cheap enough for the sample path.
+// The curve is edited from the API task while the strain task evaluates it:
+// fits are computed into a temporary and published under a spinlock, so
+// evaluate() always sees a complete set of coefficients.
+class StrainCurve {
+   public:
+    struct Point {
+        int32_t raw;    // tared raw reading
+        int32_t grams;  // known mass in g
+    };
+
+    bool addPoint(int32_t raw, float kg);
+    void clear();
+    uint8_t size();
+    const Point *point(uint8_t index);
+    uint8_t getMode();
+    bool setMode(uint8_t mode);
+    bool enabled();
+    bool fit();
+    bool evaluate(float raw, float *kg);
+
+    // Stored as a byte array of points, see Point.
+    size_t bytesSize();
+    const uint8_t *bytes();
+    bool setBytes(const uint8_t *bytes, size_t size);
+
+   protected:
+    Point _points[STRAIN_CURVE_MAX_POINTS];
+    uint8_t _size = 0;
+    uint8_t _mode = STRAIN_CURVE_OFF;
+
+    struct Fit {
+        uint8_t mode = STRAIN_CURVE_OFF;  // STRAIN_CURVE_OFF: not fitted
+
+        // piecewise-linear: segment i ends at knots[i], the last segment is open ended
+        float knots[STRAIN_CURVE_MAX_POINTS];
+        float slopes[STRAIN_CURVE_MAX_POINTS];
+        float intercepts[STRAIN_CURVE_MAX_POINTS];
+
+        // quadratic: kg = b * raw + c * raw * raw
+        float b = 0.0f;
+        float c = 0.0f;
+    };
+    Fit _fit;  // published fit, guarded by _mux
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    bool _compute(uint8_t mode, Fit *f);
+    void _publish(const Fit *f);
+};
+
+#endif
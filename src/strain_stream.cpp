@@ -0,0 +1,98 @@
+#include "strain_stream.h"
+
+bool StrainStream::push(const float *values, uint8_t channels, bool withAngle, float angle, ulong t, uint16_t size) {
+    if (STRAIN_STREAM_CHANNELS < channels) channels = STRAIN_STREAM_CHANNELS;
+    if (STRAIN_STREAM_PACKET_MAX < size) size = STRAIN_STREAM_PACKET_MAX;
+    int32_t grams[STRAIN_STREAM_CHANNELS];
+    for (uint8_t i = 0; i < channels; i++) grams[i] = lroundf(values[i] * 1000.0f);
+    const uint8_t recordSize = 2 * channels + (withAngle ? 2 : 0);
+    if (size < 4 + 4 * channels + recordSize) return false;  // does not fit
+    bool ready = false;
+    // a changed layout starts a new packet
+    if (0 < _count && (channels != _channels || withAngle != _withAngle))
+        ready = _complete();
+    if (0 == _count) _start(grams, channels, withAngle, t);
+    uint8_t *b = _buf[_fill];
+    uint16_t len = _len[_fill];
+    for (uint8_t i = 0; i < channels; i++) {
+        int32_t delta = grams[i] - _prev[i];
+        if (delta < INT16_MIN) delta = INT16_MIN;
+        if (INT16_MAX < delta) delta = INT16_MAX;
+        _prev[i] += delta;  // the client sees the clamped value, so track that
+        b[len++] = delta & 0xff;
+        b[len++] = (delta >> 8) & 0xff;
+    }
+    if (withAngle) {
+        uint16_t a = 0xffff;
+        if (0.0f <= angle) {
+            a = (uint16_t)(fmodf(angle, 360.0f) * 65536.0f / 360.0f);
+            if (0xffff == a) a = 0;  // rounds up to a full revolution
+        }
+        b[len++] = a & 0xff;
+        b[len++] = (a >> 8) & 0xff;
+    }
+    _len[_fill] = len;
+    b[3] = ++_count;
+    if (size < len + recordSize ||
+        UINT8_MAX == _count ||
+        STRAIN_STREAM_MAX_AGE_MS <= t - _started)
+        return _complete() || ready;
+    return ready;
+}
+
+// Returns true if a packet is waiting to be sent.
+bool StrainStream::pending() {
+    return _ready;
+}
+
+// Returns the packet waiting to be sent, call release() when done.
+const uint8_t *StrainStream::packet(uint16_t *len) {
+    const uint8_t i = _fill ^ 1;
+    *len = _len[i];
+    return _buf[i];
+}
+
+void StrainStream::release() {
+    _ready = false;
+}
+
+void StrainStream::reset() {
+    _count = 0;
+    _len[_fill] = 0;
+}
+
+void StrainStream::_start(const int32_t *grams, uint8_t channels, bool withAngle, ulong t) {
+    uint8_t *b = _buf[_fill];
+    uint16_t len = 0;
+    b[len++] = _seq & 0xff;
+    b[len++] = (_seq >> 8) & 0xff;
+    b[len++] = (withAngle ? flagAngle : 0) | (channels << 4);
+    b[len++] = 0;  // count
+    for (uint8_t i = 0; i < channels; i++) {
+        _prev[i] = grams[i];
+        b[len++] = grams[i] & 0xff;
+        b[len++] = (grams[i] >> 8) & 0xff;
+        b[len++] = (grams[i] >> 16) & 0xff;
+        b[len++] = (grams[i] >> 24) & 0xff;
+    }
+    _len[_fill] = len;
+    _seq++;
+    _channels = channels;
+    _withAngle = withAngle;
+    _started = t;
+}
+
+// Hands the filled buffer over to the sender, or drops it if the previous
+// packet has not been sent yet. Returns true if a packet was handed over.
+bool StrainStream::_complete() {
+    _count = 0;
+    if (_ready) {
+        dropped++;
+        _len[_fill] = 0;
+        return false;
+    }
+    _fill ^= 1;
+    _len[_fill] = 0;
+    _ready = true;
+    return true;
+}
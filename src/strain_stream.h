@@ -0,0 +1,61 @@
+#ifndef STRAIN_STREAM_H
+#define STRAIN_STREAM_H
+
+#include <Arduino.h>
+
+#ifndef STRAIN_STREAM_PACKET_MAX
+#define STRAIN_STREAM_PACKET_MAX 509  // CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU - 3
+#endif
+#ifndef STRAIN_STREAM_MAX_AGE_MS
+#define STRAIN_STREAM_MAX_AGE_MS 1000  // a packet is sent at least this often, even if not full
+#endif
+#ifndef STRAIN_STREAM_CHANNELS
+#define STRAIN_STREAM_CHANNELS 2  // maximum number of strain channels in a record
+#endif
+
+#define STRAIN_STREAM_OFF 0     // streaming disabled
+#define STRAIN_STREAM_STRAIN 1  // strain samples
+#define STRAIN_STREAM_ANGLE 2   // strain samples and crank angle
+#define STRAIN_STREAM_MAX 3     // marks the high limit
+
+// Packs strain samples into notification sized packets:
+// [seq: 2][flags: 1][count: 1][base: 4 * channels][count * record]
+// flags: bit 0: angle present, bits 4..7: number of channels
+// base: first sample of each channel in g, int32
+// record: [delta: 2 * channels][angle: 2 if present]
+// delta: change of the channel since the previous sample in g, int16, 0 in the first record
+// angle: crank angle in 1/65536 revolution, 0xffff: unknown
+// All values are little endian. The sequence number increments with every
+// packet, including dropped ones, so clients can detect loss.
+// One producer fills a packet while the other one waits to be sent.
+class StrainStream {
+   public:
+    static const uint8_t flagAngle = 1 << 0;
+
+    uint32_t dropped = 0;  // packets completed while the previous one was still waiting
+
+    // Adds a sample, values holds one value in kg per channel. angle < 0: unknown.
+    // Returns true when a packet is ready to be sent.
+    bool push(const float *values, uint8_t channels, bool withAngle, float angle, ulong t, uint16_t size);
+    bool pending();
+    const uint8_t *packet(uint16_t *len);
+    void release();
+    void reset();
+
+   protected:
+    uint8_t _buf[2][STRAIN_STREAM_PACKET_MAX];
+    uint16_t _len[2] = {0, 0};
+    uint8_t _fill = 0;                // index of the buffer being filled
+    volatile bool _ready = false;     // the other buffer is waiting to be sent
+    uint16_t _seq = 0;
+    uint8_t _count = 0;               // samples in the buffer being filled
+    uint8_t _channels = 0;            // channels in the buffer being filled
+    bool _withAngle = false;          // angles in the buffer being filled
+    int32_t _prev[STRAIN_STREAM_CHANNELS];
+    ulong _started = 0;
+
+    void _start(const int32_t *grams, uint8_t channels, bool withAngle, ulong t);
+    bool _complete();
+};
+
+#endif
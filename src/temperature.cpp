@@ -104,6 +104,14 @@ bool Temperature::setCompensationOffset() {
     return true;
 }
 
+void Temperature::setCompensationOffset(float offset) {
+    compensationOffset = offset;
+}
+
+float Temperature::getCompensationOffset() {
+    return compensationOffset;
+}
+
 void Temperature::setCompensation(float temperature) {
     if (!tc) {
         log_e("no table");
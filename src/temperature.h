@@ -58,6 +58,8 @@ class Temperature {
     void setup(::Preferences *p, TC *tc);
     TC *tc = nullptr;
     bool setCompensationOffset();
+    void setCompensationOffset(float offset);
+    float getCompensationOffset();
     float getCompensation();
 
    protected:
@@ -165,6 +165,7 @@ void TemperatureCompensation::addApiCommand() {
 }
 
 Api::Result *TemperatureCompensation::tcProcessor(Api::Message *msg) {
+    // the compensation is applied to the right strain channel only
     // get/set enabled: tc=[enabled][:0|1] -> enabled:0|1
     if (msg->argIs("") || msg->argIs("0") || msg->argIs("1") || msg->argStartsWith("enabled")) {
         if (strlen(msg->arg)) {
@@ -327,7 +328,7 @@ Api::Result *TemperatureCompensation::tcProcessor(Api::Message *msg) {
         return Api::argInvalid();
     }
     }
-    msg->replyAppend("[enabled][:0|1]|table[;size:uint16;keyOffset:int8;keyRes:float;valueRes:float;]|valuesFrom:uint16[;set:[int8],[int8],...]");
+    msg->replyAppend("[enabled][:0|1]|table[;size:uint16;keyOffset:int8;keyRes:float;valueRes:float;]|valuesFrom:uint16[;set:[int8],[int8],...] (right channel only)");
     return Api::argInvalid();
 
     /*
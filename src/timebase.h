@@ -0,0 +1,50 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <esp_timer.h>
+#else
+#include <stdint.h>
+#include <sys/types.h>
+#endif
+
+// Microsecond time base shared by the crank event pipeline. On the ESP32
+// millis() is esp_timer / 1000, so millisecond timestamps map onto it.
+// millis() is 32 bits wide, the conversions wrap it at 32 bits on any host.
+namespace Timebase {
+
+#ifdef ARDUINO
+// Returns the time since boot in µs, does not roll over in practice.
+inline int64_t us() {
+    return esp_timer_get_time();
+}
+#endif
+
+// Returns the millis() value of a µs time, rolls over like millis().
+inline ulong toMillis(const int64_t us) {
+    return (uint32_t)(us / 1000);
+}
+
+// Returns the µs time of a millis() timestamp, which must not be later than
+// nowUs and not older than the millis() period (49 days).
+inline int64_t fromMillis(const ulong t, const int64_t nowUs) {
+    const uint32_t age = (uint32_t)toMillis(nowUs) - (uint32_t)t;  // rollover safe
+    return (nowUs / 1000 - (int64_t)age) * 1000;
+}
+
+#ifdef ARDUINO
+inline int64_t fromMillis(const ulong t) {
+    return fromMillis(t, us());
+}
+#endif
+
+// Converts a µs time to the 1/1024 s crank event time of CPS and CSCS, which
+// rolls over every 64 s. Exact integer math: us * 1024 / 1000000 = us * 16 / 15625.
+inline uint16_t toCrankEventTime(const int64_t us) {
+    return (uint16_t)((uint64_t)us * 16 / 15625);
+}
+
+}  // namespace Timebase
+
+#endif
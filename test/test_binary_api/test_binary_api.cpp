@@ -0,0 +1,200 @@
+#include <string.h>
+#include <unity.h>
+
+#include "binary_api.h"
+
+// Exposes the request buffer and the TLV reader, and stands in for process()
+// which needs the board.
+class TestApi : public BinaryApi {
+   public:
+    using BinaryApi::_next;
+    using BinaryApi::_putU16;
+    using BinaryApi::_putU32;
+
+    const uint8_t *request() { return _request; }
+    uint16_t requestLen() { return _requestLen; }
+
+    void respond(uint8_t status) {
+        _response[0] = _request[0];
+        _response[1] = status;
+        _responseLen = 2;
+        _sent = 0;
+        _nextFragment = 0;
+        _responding = true;
+    }
+};
+
+static TestApi api;
+
+static bool write(uint16_t conn, uint8_t seq, uint8_t fragment, const uint8_t *payload, size_t len) {
+    uint8_t frame[BA_FRAME_HEADER + 64];
+    frame[0] = seq;
+    frame[1] = fragment;
+    memcpy(frame + BA_FRAME_HEADER, payload, len);
+    return api.onWrite(conn, frame, BA_FRAME_HEADER + len);
+}
+
+void setUp() {
+    api.reset();
+}
+
+void tearDown() {}
+
+void test_single_fragment() {
+    const uint8_t req[] = {BA_CMD_GET, BA_CRANK_LENGTH, BA_NONE, 0, 0};
+    TEST_ASSERT_TRUE(write(1, 7, BA_FRAGMENT_LAST, req, sizeof(req)));
+    TEST_ASSERT_TRUE(api.pending());
+    TEST_ASSERT_EQUAL_UINT16(sizeof(req), api.requestLen());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(req, api.request(), sizeof(req));
+}
+
+void test_reassembly() {
+    const uint8_t a[] = {BA_CMD_SET, BA_SLEEP_DELAY, BA_U32};
+    const uint8_t b[] = {4, 0, 0x10, 0x27};
+    const uint8_t c[] = {0, 0};
+    TEST_ASSERT_FALSE(write(1, 3, 0, a, sizeof(a)));
+    TEST_ASSERT_FALSE(write(1, 3, 1, b, sizeof(b)));
+    TEST_ASSERT_FALSE(api.pending());
+    TEST_ASSERT_TRUE(write(1, 3, 2 | BA_FRAGMENT_LAST, c, sizeof(c)));
+    TEST_ASSERT_EQUAL_UINT16(9, api.requestLen());
+    const uint8_t all[] = {BA_CMD_SET, BA_SLEEP_DELAY, BA_U32, 4, 0, 0x10, 0x27, 0, 0};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(all, api.request(), sizeof(all));
+}
+
+// fragments out of order, of another sequence or connection abort the request
+void test_unexpected_fragments() {
+    const uint8_t p[] = {BA_CMD_GET};
+    TEST_ASSERT_FALSE(write(1, 3, 0, p, 1));
+    TEST_ASSERT_FALSE(write(1, 3, 2 | BA_FRAGMENT_LAST, p, 1));
+    TEST_ASSERT_FALSE(api.pending());
+    TEST_ASSERT_FALSE(write(1, 3, 1 | BA_FRAGMENT_LAST, p, 1));  // the request is gone
+
+    TEST_ASSERT_FALSE(write(1, 4, 0, p, 1));
+    TEST_ASSERT_FALSE(write(1, 5, 1 | BA_FRAGMENT_LAST, p, 1));
+    TEST_ASSERT_FALSE(api.pending());
+
+    TEST_ASSERT_FALSE(write(1, 6, 0, p, 1));
+    TEST_ASSERT_FALSE(write(2, 6, 1 | BA_FRAGMENT_LAST, p, 1));
+    TEST_ASSERT_FALSE(api.pending());
+}
+
+void test_short_and_empty() {
+    const uint8_t seq = 1;
+    TEST_ASSERT_FALSE(api.onWrite(1, &seq, 1));
+    TEST_ASSERT_FALSE(write(1, 1, BA_FRAGMENT_LAST, &seq, 0));
+    TEST_ASSERT_FALSE(api.pending());
+}
+
+// a request larger than BINARY_API_MESSAGE_MAX is completed but flagged
+void test_overflow() {
+    uint8_t p[64] = {BA_CMD_GET};
+    uint8_t i = 0;
+    for (; (i + 1) * sizeof(p) <= BINARY_API_MESSAGE_MAX; i++)
+        TEST_ASSERT_FALSE(write(1, 9, i, p, sizeof(p)));
+    TEST_ASSERT_TRUE(write(1, 9, i | BA_FRAGMENT_LAST, p, sizeof(p)));
+    TEST_ASSERT_EQUAL_UINT16(BINARY_API_MESSAGE_MAX, api.requestLen());
+}
+
+// while a request is pending, fragments of other requests are dropped
+void test_busy() {
+    const uint8_t p[] = {BA_CMD_STATS};
+    TEST_ASSERT_TRUE(write(1, 1, BA_FRAGMENT_LAST, p, 1));
+    TEST_ASSERT_FALSE(write(2, 2, BA_FRAGMENT_LAST, p, 1));
+    TEST_ASSERT_EQUAL_UINT8(BA_CMD_STATS, api.request()[0]);
+}
+
+void test_tlv() {
+    const uint8_t req[] = {BA_CMD_SET,
+                           BA_SLEEP_DELAY, BA_U32, 4, 0, 0x10, 0x27, 0, 0,
+                           BA_MDM, BA_U8, 1, 0, 2,
+                           BA_TC_VALUES, BA_BYTES, 3, 0, 0xff, 0, 1,
+                           BA_CRANK_LENGTH, BA_FLOAT, 4, 0};  // truncated
+    TEST_ASSERT_TRUE(write(1, 1, BA_FRAGMENT_LAST, req, sizeof(req)));
+    uint16_t offset = 1;
+    BinaryApi::Value v;
+    TEST_ASSERT_TRUE(api._next(&offset, &v));
+    TEST_ASSERT_EQUAL_UINT8(BA_SLEEP_DELAY, v.tag);
+    TEST_ASSERT_TRUE(v.isNumber());
+    TEST_ASSERT_EQUAL_INT32(10000, v.toInt());
+    TEST_ASSERT_TRUE(api._next(&offset, &v));
+    TEST_ASSERT_EQUAL_UINT8(BA_MDM, v.tag);
+    TEST_ASSERT_EQUAL_INT32(2, v.toInt());
+    TEST_ASSERT_EQUAL_FLOAT(2.0f, v.toFloat());
+    TEST_ASSERT_TRUE(api._next(&offset, &v));
+    TEST_ASSERT_EQUAL_UINT8(BA_TC_VALUES, v.tag);
+    TEST_ASSERT_FALSE(v.isNumber());
+    TEST_ASSERT_EQUAL_UINT16(3, v.len);
+    TEST_ASSERT_EQUAL_INT8(-1, (int8_t)v.data[0]);
+    TEST_ASSERT_FALSE(api._next(&offset, &v));
+    TEST_ASSERT_EQUAL_UINT16(sizeof(req) - 4, offset);
+}
+
+// numbers must have the size of their type
+void test_value_types() {
+    const uint8_t i16[] = {0xfe, 0xff};
+    const float f = -1.6f;
+    BinaryApi::Value v = {0, BA_I16, 2, i16};
+    TEST_ASSERT_TRUE(v.isNumber());
+    TEST_ASSERT_EQUAL_INT32(-2, v.toInt());
+    v.type = BA_U16;
+    TEST_ASSERT_EQUAL_INT32(65534, v.toInt());
+    v.type = BA_U32;
+    TEST_ASSERT_FALSE(v.isNumber());
+    v = {0, BA_FLOAT, 4, (const uint8_t *)&f};
+    TEST_ASSERT_EQUAL_INT32(-2, v.toInt());
+    TEST_ASSERT_EQUAL_FLOAT(-1.6f, v.toFloat());
+}
+
+// the response is split into frames of at most the given size
+void test_frames() {
+    const uint8_t p[] = {BA_CMD_GET};
+    TEST_ASSERT_TRUE(write(1, 5, BA_FRAGMENT_LAST, p, 1));
+    api.respond(BA_SUCCESS);
+    api._putU32(BA_SLEEP_DELAY, 10000);  // response: 2 + 8 bytes
+    uint16_t len;
+    const uint8_t *f = api.frame(6, &len);
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL_UINT16(6, len);
+    const uint8_t f0[] = {5, 0, BA_CMD_GET, BA_SUCCESS, BA_SLEEP_DELAY, BA_U32};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(f0, f, len);
+    f = api.frame(6, &len);
+    const uint8_t f1[] = {5, 1, 4, 0, 0x10, 0x27};
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(f1, f, len);
+    f = api.frame(6, &len);
+    const uint8_t f2[] = {5, 2 | BA_FRAGMENT_LAST, 0, 0};
+    TEST_ASSERT_EQUAL_UINT16(4, len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(f2, f, len);
+    TEST_ASSERT_NULL(api.frame(6, &len));
+    TEST_ASSERT_FALSE(api.pending());
+    TEST_ASSERT_TRUE(write(1, 6, BA_FRAGMENT_LAST, p, 1));  // ready for the next request
+}
+
+// a response that can not be sent is replaced by a single error frame
+void test_failed() {
+    const uint8_t p[] = {BA_CMD_TC_GET};
+    TEST_ASSERT_TRUE(write(1, 8, BA_FRAGMENT_LAST, p, 1));
+    api.respond(BA_SUCCESS);
+    api._putU16(BA_TC_SIZE, 100);
+    uint16_t len;
+    TEST_ASSERT_NOT_NULL(api.frame(4, &len));
+    const uint8_t *f = api.failed(&len);
+    const uint8_t e[] = {8, BA_FRAGMENT_LAST, BA_CMD_TC_GET, BA_FAILED};
+    TEST_ASSERT_EQUAL_UINT16(sizeof(e), len);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(e, f, len);
+    TEST_ASSERT_NULL(api.frame(4, &len));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_single_fragment);
+    RUN_TEST(test_reassembly);
+    RUN_TEST(test_unexpected_fragments);
+    RUN_TEST(test_short_and_empty);
+    RUN_TEST(test_overflow);
+    RUN_TEST(test_busy);
+    RUN_TEST(test_tlv);
+    RUN_TEST(test_value_types);
+    RUN_TEST(test_frames);
+    RUN_TEST(test_failed);
+    return UNITY_END();
+}
@@ -0,0 +1,135 @@
+#include <unity.h>
+
+#include "cadence_tracker.h"
+
+static CadenceTracker tracker;
+static ulong t;
+static uint32_t counted;
+
+// Feeds an event dt ms after the previous one, returns the tracker's verdict.
+static CadenceTracker::Event step(ulong dt) {
+    t += dt;
+    CadenceTracker::Event e = tracker.onEvent(t);
+    counted += e.revolutions;
+    return e;
+}
+
+// Rides n revolutions of period ms from a standstill, the tracker is seeded.
+static void ride(uint8_t n, ulong period) {
+    for (uint8_t i = 0; i < n; i++) step(period);
+}
+
+void setUp() {
+    tracker = CadenceTracker();
+    t = 100000;
+    tracker.onEvent(t);  // restart
+    counted = 0;
+}
+
+void tearDown() {}
+
+void test_steady() {
+    ride(20, 1000);
+    TEST_ASSERT_EQUAL_UINT32(20, counted);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 60.0f, tracker.rpm(t));
+}
+
+// 40 rpm to 90 rpm within one revolution, e.g. a standing start
+void test_acceleration() {
+    ride(8, 1500);
+    counted = 0;
+    for (uint8_t i = 0; i < 16; i++) {
+        CadenceTracker::Event e = step(667);
+        if (8 <= i && 0 < e.revolutions) TEST_ASSERT_UINT32_WITHIN(20, 667, e.dt);
+    }
+    TEST_ASSERT_UINT32_WITHIN(1, 16, counted);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, 90.0f, tracker.rpm(t));
+}
+
+// 90 rpm to 60 rpm within one revolution, not counted as two revolutions
+void test_deceleration() {
+    ride(8, 667);
+    counted = 0;
+    for (uint8_t i = 0; i < 16; i++) {
+        CadenceTracker::Event e = step(1000);
+        TEST_ASSERT_EQUAL_UINT8(1, e.revolutions);
+    }
+    TEST_ASSERT_EQUAL_UINT32(16, counted);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, 60.0f, tracker.rpm(t));
+}
+
+// 90 rpm to 45 rpm within one revolution
+void test_halving() {
+    ride(8, 667);
+    counted = 0;
+    ride(16, 1334);
+    TEST_ASSERT_UINT32_WITHIN(2, 16, counted);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, 45.0f, tracker.rpm(t));
+}
+
+void test_double_trigger() {
+    ride(8, 1000);
+    counted = 0;
+    CadenceTracker::Event e = step(500);
+    TEST_ASSERT_EQUAL_UINT8(0, e.revolutions);
+    e = step(500);
+    TEST_ASSERT_EQUAL_UINT8(1, e.revolutions);
+    TEST_ASSERT_EQUAL_UINT32(1000, e.dt);
+    ride(8, 1000);
+    TEST_ASSERT_EQUAL_UINT32(9, counted);
+    TEST_ASSERT_EQUAL_UINT32(1, tracker.rejected);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 60.0f, tracker.rpm(t));
+}
+
+void test_missed_event() {
+    ride(8, 1000);
+    counted = 0;
+    CadenceTracker::Event e = step(2000);
+    TEST_ASSERT_EQUAL_UINT8(2, e.revolutions);
+    TEST_ASSERT_EQUAL_UINT32(1000, e.dt);
+    ride(8, 1000);
+    TEST_ASSERT_EQUAL_UINT32(10, counted);
+    TEST_ASSERT_EQUAL_UINT32(1, tracker.missed);
+}
+
+void test_restart_after_pause() {
+    ride(8, 1000);
+    CadenceTracker::Event e = step(CADENCE_TIMEOUT_MS + 1);
+    TEST_ASSERT_TRUE(e.restarted);
+    TEST_ASSERT_EQUAL_UINT8(0, e.revolutions);
+    e = step(1200);
+    TEST_ASSERT_EQUAL_UINT8(1, e.revolutions);
+    TEST_ASSERT_EQUAL_UINT32(1200, e.dt);
+}
+
+// the time per revolution is also reported from the µs event times
+void test_us_dt() {
+    int64_t us = (int64_t)t * 1000 + 250;
+    tracker = CadenceTracker();
+    tracker.onEvent(t, us);
+    for (uint8_t i = 0; i < 4; i++) {
+        t += 1000;
+        us += 999750;
+        CadenceTracker::Event e = tracker.onEvent(t, us);
+        TEST_ASSERT_EQUAL_UINT32(1000, e.dt);
+        TEST_ASSERT_EQUAL_UINT32(999750, e.dtUs);
+    }
+    t += 2000;
+    us += 2000500;
+    CadenceTracker::Event e = tracker.onEvent(t, us);
+    TEST_ASSERT_EQUAL_UINT8(2, e.revolutions);
+    TEST_ASSERT_EQUAL_UINT32(1000250, e.dtUs);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_steady);
+    RUN_TEST(test_acceleration);
+    RUN_TEST(test_deceleration);
+    RUN_TEST(test_halving);
+    RUN_TEST(test_double_trigger);
+    RUN_TEST(test_missed_event);
+    RUN_TEST(test_restart_after_pause);
+    RUN_TEST(test_us_dt);
+    return UNITY_END();
+}
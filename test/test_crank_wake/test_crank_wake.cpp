@@ -0,0 +1,138 @@
+#include <unity.h>
+
+#include "crank_wake.h"
+
+#define THRES_LOW 2
+#define THRES_HIGH 10
+
+static CrankWake wake;
+
+// Steps the idle loop like Board::_idleLoop(), one hall sample per tick,
+// returns the tick at which the pipeline resumes, -1 if it does not.
+static int runHall(const int *samples, int n) {
+    for (int i = 0; i < n; i++) {
+        if (wake.onTick()) return i;
+        if (wake.onHallSample(samples[i])) return i;
+    }
+    return -1;
+}
+
+// Steps the idle loop for n ticks with wake-on-motion interrupts at the given
+// ticks, returns the tick at which the pipeline resumes, -1 if it does not.
+static int runWom(const int *interrupts, int count, int n) {
+    int next = 0;
+    for (int i = 0; i < n; i++) {
+        if (wake.onTick()) return i;
+        if (next < count && interrupts[next] == i) {
+            next++;
+            if (wake.onWomInterrupt()) return i;
+        }
+    }
+    return -1;
+}
+
+void setUp() {
+    wake = CrankWake();
+}
+
+void tearDown() {}
+
+void test_hall_magnet_pass() {
+    wake.arm(CRANK_WAKE_HALL, THRES_LOW, THRES_HIGH);
+    const int samples[] = {0, 1, -1, 0, 4, 12, 25, 14, 3, 0};
+    TEST_ASSERT_EQUAL_INT(5, runHall(samples, 10));
+    TEST_ASSERT_TRUE(wake.fired());
+}
+
+// the south pole of the magnet reads negative
+void test_hall_negative_pass() {
+    wake.arm(CRANK_WAKE_HALL, THRES_LOW, THRES_HIGH);
+    const int samples[] = {1, 0, -6, -18, -30, -9, 0};
+    TEST_ASSERT_EQUAL_INT(3, runHall(samples, 7));
+}
+
+void test_hall_noise() {
+    wake.arm(CRANK_WAKE_HALL, THRES_LOW, THRES_HIGH);
+    const int samples[] = {0, 3, -4, 8, -9, 10, -10, 5, 1, -2};
+    TEST_ASSERT_EQUAL_INT(-1, runHall(samples, 10));
+    TEST_ASSERT_FALSE(wake.fired());
+}
+
+// the bike is parked with the magnet over the sensor: no wake until the
+// magnet moves away and comes back
+void test_hall_parked_on_magnet() {
+    wake.arm(CRANK_WAKE_HALL, THRES_LOW, THRES_HIGH);
+    const int parked[] = {20, 21, 19, 20, 22, 20};
+    TEST_ASSERT_EQUAL_INT(-1, runHall(parked, 6));
+    const int moving[] = {12, 5, 1, 0, 8, 16};
+    TEST_ASSERT_EQUAL_INT(5, runHall(moving, 6));
+}
+
+void test_wom_single_knock() {
+    wake.arm(CRANK_WAKE_WOM);
+    const int interrupts[] = {10};
+    TEST_ASSERT_EQUAL_INT(-1, runWom(interrupts, 1, 200));
+}
+
+void test_wom_pedaling() {
+    wake.arm(CRANK_WAKE_WOM);
+    const int interrupts[] = {10, 30};
+    TEST_ASSERT_EQUAL_INT(30, runWom(interrupts, 2, 200));
+    TEST_ASSERT_TRUE(wake.fired());
+}
+
+// two knocks further apart than the window
+void test_wom_window_expires() {
+    wake.arm(CRANK_WAKE_WOM);
+    const int interrupts[] = {10, 11 + CRANK_WAKE_WOM_WINDOW};
+    TEST_ASSERT_EQUAL_INT(-1, runWom(interrupts, 2, 200));
+}
+
+// a fired wake is reported on the next tick as well, e.g. after light sleep
+void test_fired_is_latched() {
+    wake.arm(CRANK_WAKE_WOM);
+    wake.onWomInterrupt();
+    wake.onWomInterrupt();
+    TEST_ASSERT_TRUE(wake.onTick());
+}
+
+void test_wrong_source_ignored() {
+    wake.arm(CRANK_WAKE_WOM);
+    const int samples[] = {0, 20};
+    TEST_ASSERT_EQUAL_INT(-1, runHall(samples, 2));
+    wake.arm(CRANK_WAKE_HALL, THRES_LOW, THRES_HIGH);
+    TEST_ASSERT_FALSE(wake.onWomInterrupt());
+    TEST_ASSERT_FALSE(wake.onWomInterrupt());
+}
+
+void test_disarmed() {
+    wake.arm(CRANK_WAKE_HALL, THRES_LOW, THRES_HIGH);
+    wake.disarm();
+    const int samples[] = {0, 20};
+    TEST_ASSERT_EQUAL_INT(-1, runHall(samples, 2));
+    TEST_ASSERT_EQUAL_UINT8(CRANK_WAKE_NONE, wake.source());
+}
+
+void test_ticks() {
+    wake.arm(CRANK_WAKE_WOM);
+    runWom(nullptr, 0, 50);
+    TEST_ASSERT_EQUAL_UINT32(50, wake.ticks());
+    wake.arm(CRANK_WAKE_WOM);
+    TEST_ASSERT_EQUAL_UINT32(0, wake.ticks());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_hall_magnet_pass);
+    RUN_TEST(test_hall_negative_pass);
+    RUN_TEST(test_hall_noise);
+    RUN_TEST(test_hall_parked_on_magnet);
+    RUN_TEST(test_wom_single_knock);
+    RUN_TEST(test_wom_pedaling);
+    RUN_TEST(test_wom_window_expires);
+    RUN_TEST(test_fired_is_latched);
+    RUN_TEST(test_wrong_source_ignored);
+    RUN_TEST(test_disarmed);
+    RUN_TEST(test_ticks);
+    return UNITY_END();
+}
@@ -0,0 +1,101 @@
+#include <unity.h>
+
+#include "hall_sampler.h"
+
+static HallSampler sampler;
+static int next;
+
+static int source() {
+    return next;
+}
+
+void setUp() {
+    sampler = HallSampler();
+    next = 0;
+}
+
+void tearDown() {}
+
+void test_window_fills() {
+    sampler.begin(4);
+    for (int i = 0; i < 3; i++) {
+        sampler.feed(10);
+        TEST_ASSERT_FALSE(sampler.available());
+    }
+    sampler.feed(10);
+    TEST_ASSERT_TRUE(sampler.available());
+    TEST_ASSERT_EQUAL_INT(10, sampler.read());
+    TEST_ASSERT_FALSE(sampler.available());
+}
+
+// once full, every reading publishes the average of the last window readings
+void test_running_average() {
+    sampler.begin(4);
+    const int readings[] = {4, 8, 12, 16, 20, 24};
+    for (int r : readings) sampler.feed(r);
+    TEST_ASSERT_TRUE(sampler.available());
+    TEST_ASSERT_EQUAL_INT(18, sampler.read());  // (12 + 16 + 20 + 24) / 4
+    sampler.feed(0);
+    TEST_ASSERT_EQUAL_INT(15, sampler.read());  // (16 + 20 + 24 + 0) / 4
+}
+
+// the sum is divided once, rounded half away from zero
+void test_rounding() {
+    sampler.begin(4);
+    const int readings[] = {1, 1, 0, 0};  // 0.5
+    for (int r : readings) sampler.feed(r);
+    TEST_ASSERT_EQUAL_INT(1, sampler.read());
+    sampler.feed(0);  // 1, 0, 0, 0: 0.25
+    TEST_ASSERT_EQUAL_INT(0, sampler.read());
+}
+
+void test_rounding_negative() {
+    sampler.begin(4);
+    const int readings[] = {-1, -1, 0, 0};  // -0.5
+    for (int r : readings) sampler.feed(r);
+    TEST_ASSERT_EQUAL_INT(-1, sampler.read());
+    sampler.feed(-2);  // -1, 0, 0, -2: -0.75
+    TEST_ASSERT_EQUAL_INT(-1, sampler.read());
+    sampler.feed(0);  // 0, 0, -2, 0: -0.5
+    TEST_ASSERT_EQUAL_INT(-1, sampler.read());
+    sampler.feed(1);  // 0, -2, 0, 1: -0.25
+    TEST_ASSERT_EQUAL_INT(0, sampler.read());
+}
+
+void test_window_limits() {
+    sampler.begin(0);
+    sampler.feed(-7);
+    TEST_ASSERT_EQUAL_INT(-7, sampler.read());
+    sampler.begin(HALL_SAMPLER_WINDOW_MAX + 10);
+    for (int i = 0; i < HALL_SAMPLER_WINDOW_MAX - 1; i++) sampler.feed(3);
+    TEST_ASSERT_FALSE(sampler.available());
+    sampler.feed(3);
+    TEST_ASSERT_EQUAL_INT(3, sampler.read());
+}
+
+// sample() takes one reading per call from the source, only while running
+void test_source() {
+    sampler.sample();
+    TEST_ASSERT_FALSE(sampler.available());
+    sampler.begin(2, source);
+    next = -3;
+    sampler.sample();
+    TEST_ASSERT_FALSE(sampler.available());
+    next = -6;
+    sampler.sample();
+    TEST_ASSERT_EQUAL_INT(-5, sampler.read());  // -4.5
+    sampler.end();
+    sampler.sample();
+    TEST_ASSERT_FALSE(sampler.available());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_window_fills);
+    RUN_TEST(test_running_average);
+    RUN_TEST(test_rounding);
+    RUN_TEST(test_rounding_negative);
+    RUN_TEST(test_window_limits);
+    RUN_TEST(test_source);
+    return UNITY_END();
+}
@@ -0,0 +1,70 @@
+#include <unity.h>
+
+#include "timebase.h"
+
+#define S 1000000LL  // µs
+#define MILLIS_PERIOD_US (4294967296LL * 1000)  // millis() rolls over after 2^32 ms
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_crank_event_time() {
+    TEST_ASSERT_EQUAL_UINT16(0, Timebase::toCrankEventTime(0));
+    TEST_ASSERT_EQUAL_UINT16(1024, Timebase::toCrankEventTime(S));
+    TEST_ASSERT_EQUAL_UINT16(1, Timebase::toCrankEventTime(977));  // 1/1024 s = 976.5625 µs
+    TEST_ASSERT_EQUAL_UINT16(0, Timebase::toCrankEventTime(976));
+}
+
+// the crank event time rolls over every 64 s, intervals across it stay exact
+void test_crank_event_time_wrap() {
+    TEST_ASSERT_EQUAL_UINT16(0, Timebase::toCrankEventTime(64 * S));
+    const uint16_t before = Timebase::toCrankEventTime(64 * S - 700000);
+    const uint16_t after = Timebase::toCrankEventTime(64 * S + 300000);
+    TEST_ASSERT_TRUE(after < before);
+    TEST_ASSERT_EQUAL_UINT16(1024, (uint16_t)(after - before));
+}
+
+// no drift after days of uptime
+void test_crank_event_time_no_drift() {
+    const int64_t day = 86400 * S;
+    for (int64_t us = 10 * day; us < 10 * day + 10 * S; us += S) {
+        const uint16_t a = Timebase::toCrankEventTime(us);
+        const uint16_t b = Timebase::toCrankEventTime(us + 666667);
+        TEST_ASSERT_UINT32_WITHIN(1, 683, (uint16_t)(b - a));  // 0.666667 s * 1024
+    }
+    // 10 days is 843750000 ticks exactly
+    TEST_ASSERT_EQUAL_UINT16((uint16_t)(10 * 86400LL * 1024), Timebase::toCrankEventTime(10 * day));
+}
+
+void test_to_millis_wrap() {
+    TEST_ASSERT_EQUAL_UINT32(1234, Timebase::toMillis(1234567));
+    TEST_ASSERT_EQUAL_UINT32(0, Timebase::toMillis(MILLIS_PERIOD_US));
+    TEST_ASSERT_EQUAL_UINT32(500, Timebase::toMillis(MILLIS_PERIOD_US + 500999));
+}
+
+void test_from_millis() {
+    const int64_t now = 3600 * S + 123456;
+    TEST_ASSERT_EQUAL_INT64(3598123000LL, Timebase::fromMillis(Timebase::toMillis(now) - 2000, now));
+    TEST_ASSERT_EQUAL_INT64(now / 1000 * 1000, Timebase::fromMillis(Timebase::toMillis(now), now));
+}
+
+// a timestamp taken before the 49 day millis() rollover, converted after it
+void test_from_millis_wrap() {
+    const int64_t now = MILLIS_PERIOD_US + 100 * 1000 + 42;  // millis() is 100
+    const ulong t = 0xffffff00;                              // 356 ms earlier
+    TEST_ASSERT_EQUAL_UINT32(100, Timebase::toMillis(now));
+    TEST_ASSERT_EQUAL_INT64(MILLIS_PERIOD_US - 256 * 1000, Timebase::fromMillis(t, now));
+    TEST_ASSERT_EQUAL_UINT32(t, Timebase::toMillis(Timebase::fromMillis(t, now)));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_crank_event_time);
+    RUN_TEST(test_crank_event_time_wrap);
+    RUN_TEST(test_crank_event_time_no_drift);
+    RUN_TEST(test_to_millis_wrap);
+    RUN_TEST(test_from_millis);
+    RUN_TEST(test_from_millis_wrap);
+    return UNITY_END();
+}